@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2009, Swedish Institute of Computer Science
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/*
+ * Timer B capture of the SFD pin, in place of the msp430 one: the falling
+ * SFD edge ends the receptions started by cc2420_interrupt().
+ */
+
+#include "contiki.h"
+#include "dev/spi.h"
+#include "dev/cc2420-tsch.h"
+#include "isr_compat.h"
+
+/*---------------------------------------------------------------------------*/
+ISR(TIMERB1, cc2420_timerb1_interrupt)
+{
+  int tbiv;
+  ENERGEST_ON(ENERGEST_TYPE_IRQ);
+  /* always read TBIV to clear IFG */
+  tbiv = TBIV;
+  if(tbiv == 2) { /* TBCCR1 captured an SFD edge */
+    if(cc2420_sfd_interrupt()) {
+      LPM4_EXIT;
+    }
+  }
+  ENERGEST_OFF(ENERGEST_TYPE_IRQ);
+}
+/*---------------------------------------------------------------------------*/
+void
+cc2420_arch_sfd_init(void)
+{
+  /* Need to select the special function! */
+  P4SEL = BV(CC2420_SFD_PIN);
+
+  /* start timer B - 32768 ticks per second */
+  TBCTL = TBSSEL_1 | TBCLR;
+
+  /* CM_3 = capture mode - capture on both edges. The capture interrupt
+   * is only enabled while a reception waits for its end */
+  TBCCTL1 = CM_3 | CAP | SCS;
+
+  /* Start Timer_B in continuous mode. */
+  TBCTL |= MC1;
+
+  TBR = RTIMER_NOW();
+}
+/*---------------------------------------------------------------------------*/
@@ -290,9 +290,135 @@ set_txpower(uint8_t power)
 #define FIFOP_THR(n) ((n) & 0x7f)
 #define RXBPF_LOCUR (1 << 13);
 /*---------------------------------------------------------------------------*/
-/* Data structure used as the internal RX buffer */
-MEMB(rf_memb, struct received_frame_s, 2);
+/* Data structure used as the internal RX buffer. A frame that finds
+ * the pool full is NACKed, so the pool must absorb the bursts received
+ * in consecutive cells before cc2420_process delivers them */
+#ifndef CC2420_CONF_RX_POOL_SIZE
+#define CC2420_CONF_RX_POOL_SIZE 2
+#endif /* CC2420_CONF_RX_POOL_SIZE */
+MEMB(rf_memb, struct received_frame_s, CC2420_CONF_RX_POOL_SIZE);
 LIST(rf_list);
+static struct cc2420_rx_pool_stats rx_pool_stats;
+/*---------------------------------------------------------------------------*/
+static struct received_frame_s *
+rf_alloc(void)
+{
+  struct received_frame_s *rf = memb_alloc(&rf_memb);
+  if(rf != NULL) {
+    rx_pool_stats.allocs++;
+    if(++rx_pool_stats.in_use > rx_pool_stats.peak) {
+      rx_pool_stats.peak = rx_pool_stats.in_use;
+    }
+  } else {
+    rx_pool_stats.nacks++;
+  }
+  return rf;
+}
+/*---------------------------------------------------------------------------*/
+static void
+rf_free(struct received_frame_s *rf)
+{
+  memb_free(&rf_memb, rf);
+  rx_pool_stats.in_use--;
+}
+/*---------------------------------------------------------------------------*/
+const struct cc2420_rx_pool_stats *
+cc2420_get_rx_pool_stats(void)
+{
+  return &rx_pool_stats;
+}
+/*---------------------------------------------------------------------------*/
+void
+cc2420_reset_rx_pool_stats(void)
+{
+  rx_pool_stats.allocs = 0;
+  rx_pool_stats.nacks = 0;
+  rx_pool_stats.peak = rx_pool_stats.in_use;
+}
+/*---------------------------------------------------------------------------*/
+#if CC2420_CONF_SPI_DMA
+/* Both channels move one byte per trigger (single transfer mode) and
+ * clear DMAEN once count bytes are done. USART0 is the SPI master, so a
+ * byte is always received before the one after the next is sent: DMA0,
+ * which has priority, keeps up with DMA1 and RXBUF never overruns. */
+static const uint8_t spi_dma_dummy = 0;
+
+void
+cc2420_spi_dma_init(void)
+{
+  DMACTL0 = (DMACTL0 & ~(DMA0TSEL_15 | DMA1TSEL_15)) | DMA0TSEL_3 | DMA1TSEL_4;
+}
+/*---------------------------------------------------------------------------*/
+/* The DMA triggers on a rising edge of UTXIFG0, which is set while the
+ * transmitter is idle: raise it again to send the first byte */
+#define SPI_DMA_KICK_TX()                                    \
+  do {                                                       \
+    IFG1 &= ~UTXIFG0;                                        \
+    IFG1 |= UTXIFG0;                                         \
+  } while(0)
+
+void
+cc2420_spi_dma_read(uint8_t *buf, uint8_t count)
+{
+  if(count < CC2420_CONF_SPI_DMA_MIN_LEN) {
+    uint8_t i;
+    for(i = 0; i < count; i++) {
+      SPI_READ(buf[i]);
+    }
+    return;
+  }
+  DMA0SA = (unsigned int)&SPI_RXBUF;
+  DMA0DA = (unsigned int)buf;
+  DMA0SZ = count;
+  DMA0CTL = DMADT_0 | DMASRCINCR_0 | DMADSTINCR_3 | DMASBDB | DMAEN;
+  DMA1SA = (unsigned int)&spi_dma_dummy;
+  DMA1DA = (unsigned int)&SPI_TXBUF;
+  DMA1SZ = count;
+  DMA1CTL = DMADT_0 | DMASRCINCR_0 | DMADSTINCR_0 | DMASBDB | DMAEN;
+  SPI_DMA_KICK_TX();
+  BUSYWAIT_UNTIL(!(DMA0CTL & DMAEN), CC2420_CONF_SPI_DMA_TIMEOUT);
+  if(DMA0CTL & DMAEN) {
+    /* Lost a trigger: stop feeding the transmitter, let DMA0 take the
+       last byte on the wire, then poll what is left (DMA0SZ counts down) */
+    uint8_t i;
+    COOJA_DEBUG_STR("cc2420: DMA read timeout\n");
+    DMA1CTL &= ~DMAEN;
+    SPI_WAITFORTx_ENDED();
+    DMA0CTL &= ~DMAEN;
+    for(i = count - DMA0SZ; i < count; i++) {
+      SPI_READ(buf[i]);
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+cc2420_spi_dma_write(const uint8_t *buf, uint8_t count)
+{
+  if(count < CC2420_CONF_SPI_DMA_MIN_LEN) {
+    uint8_t i;
+    for(i = 0; i < count; i++) {
+      SPI_WRITE_FAST(buf[i]);
+    }
+    return;
+  }
+  DMA1SA = (unsigned int)buf;
+  DMA1DA = (unsigned int)&SPI_TXBUF;
+  DMA1SZ = count;
+  DMA1CTL = DMADT_0 | DMASRCINCR_3 | DMADSTINCR_0 | DMASBDB | DMAEN;
+  SPI_DMA_KICK_TX();
+  BUSYWAIT_UNTIL(!(DMA1CTL & DMAEN), CC2420_CONF_SPI_DMA_TIMEOUT);
+  if(DMA1CTL & DMAEN) {
+    /* Lost a trigger: write what is left (DMA1SZ counts down) by polling */
+    uint8_t i;
+    COOJA_DEBUG_STR("cc2420: DMA write timeout\n");
+    DMA1CTL &= ~DMAEN;
+    SPI_WAITFORTx_ENDED();
+    for(i = count - DMA1SZ; i < count; i++) {
+      SPI_WRITE_FAST(buf[i]);
+    }
+  }
+}
+#endif /* CC2420_CONF_SPI_DMA */
 /*---------------------------------------------------------------------------*/
 int
 cc2420_init(void)
@@ -303,6 +429,9 @@ cc2420_init(void)
   {
     int s = splhigh();
     cc2420_arch_init();		/* Initalize ports and SPI. */
+#if CC2420_CONF_SPI_DMA
+    cc2420_spi_dma_init();
+#endif /* CC2420_CONF_SPI_DMA */
     CC2420_DISABLE_FIFOP_INT();
     CC2420_FIFOP_INT_INIT();
     splx(s);
@@ -354,6 +483,7 @@ cc2420_init(void)
   flushrx();
   memb_init(&rf_memb);
   list_init(rf_list);
+  memset(&rx_pool_stats, 0, sizeof(rx_pool_stats));
   process_start(&cc2420_process, NULL);
   return 1;
 }
@@ -390,6 +520,8 @@ cc2420_transmit(unsigned short payload_len)
 #endif /* WITH_SEND_CCA */
   for(i = LOOP_20_SYMBOLS; i > 0; i--) {
     if(CC2420_SFD_IS_1) {
+      /* Timer B captured the rising SFD edge (if enabled by cc2420_sfd_sync) */
+      cc2420_sfd_start_time = cc2420_read_sfd_timer();
       if(receive_on) {
       	ENERGEST_OFF(ENERGEST_TYPE_LISTEN);
       }
@@ -397,6 +529,8 @@ cc2420_transmit(unsigned short payload_len)
       /* We wait until transmission has ended so that we get an
 	 	 	 * accurate measurement of the transmission time.	*/
       BUSYWAIT_UNTIL(!(status() & BV(CC2420_TX_ACTIVE)), RTIMER_SECOND / 10);
+      /* ... and now the falling one */
+      cc2420_sfd_end_time = cc2420_read_sfd_timer();
       ENERGEST_OFF(ENERGEST_TYPE_TRANSMIT);
 
 			/* We need to explicitly turn off the radio,
@@ -583,6 +717,7 @@ cc2420_set_pan_addr(unsigned pan,
 
 static softack_make_callback_f *softack_make_callback = NULL;
 static softack_interrupt_exit_callback_f *interrupt_exit_callback = NULL;
+static rx_frame_callback_f *rx_frame_callback = NULL;
 
 /* Subscribe with two callbacks called from FIFOP interrupt */
 void
@@ -592,11 +727,30 @@ cc2420_softack_subscribe(softack_make_callback_f *softack_make, softack_interrup
   interrupt_exit_callback = interrupt_exit;
 }
 
+/* Subscribe with a callback that sees received frames in place, in the
+ * RX pool, before they are copied to packetbuf */
+void
+cc2420_rx_subscribe(rx_frame_callback_f *rx_frame)
+{
+  rx_frame_callback = rx_frame;
+}
+
 volatile rtimer_clock_t rx_end_time=0;
 rtimer_clock_t cc2420_get_rx_end_time(void)
 {
 	return rx_end_time;
 }
+/*---------------------------------------------------------------------------*/
+/* SFD edges of the last transmission, captured by timer B. Capturing both
+ * edges must be enabled with cc2420_sfd_sync(1, 1) before transmitting */
+rtimer_clock_t cc2420_get_tx_start_time(void)
+{
+	return cc2420_sfd_start_time;
+}
+rtimer_clock_t cc2420_get_tx_end_time(void)
+{
+	return cc2420_sfd_end_time;
+}
 
 #if CC2420_TIMETABLE_PROFILING
 #define cc2420_timetable_size 16
@@ -686,6 +840,30 @@ extract_sender_address(struct received_frame_s* frame) {
 	}
 }
 /*---------------------------------------------------------------------------*/
+/* A frame is received in two interrupt stages. The FIFOP interrupt reads
+ * its header and writes the ACK to the TX FIFO; the falling SFD edge,
+ * captured by timer B, ends it. The CPU is free in between, instead of
+ * spinning in the interrupt for the rest of the frame. */
+enum {
+  RX_IDLE,
+  RX_FRAME,             /* reading a frame, we own the FIFO */
+  RX_DISCARD,           /* dropping a frame, the FIFO is flushed */
+  RX_DISCARD_UNLOCKED,  /* dropping a frame, someone else owns the FIFO */
+};
+
+static struct {
+  struct received_frame_s *rf;  /* NULL if the pool was full */
+  uint8_t len;
+  uint8_t len_a;                /* bytes read by the FIFOP stage */
+  uint8_t do_ack;
+  uint8_t is_ack;
+  uint8_t nack;
+  uint16_t capture_mode;        /* timer B capture mode to restore */
+  volatile uint8_t stage;
+} rx_state;
+
+static int rx_end_stage(uint16_t end_time);
+/*---------------------------------------------------------------------------*/
 /* Configures timer B to capture SFD edge (start, end, both),
  * and sets the cell start time for calculating synchronization in ACK */
 void
@@ -696,17 +874,23 @@ cc2420_sfd_sync(uint8_t capture_start_sfd, uint8_t capture_end_sfd)
 //#define CM_2                (2<<14) /* Capture mode: 1 - neg. edge */
 //#define CM_3                (3<<14) /* Capture mode: 1 - both edges */
 
+	uint16_t mode;
 	if(capture_start_sfd & capture_end_sfd) {
-	  TBCCTL1 = CM_3 | CAP | SCS;
+	  mode = CM_3;
 	} else if(capture_start_sfd) {
-	  TBCCTL1 = CM_1 | CAP | SCS;
+	  mode = CM_1;
 	} else if(capture_end_sfd){
-	  TBCCTL1 = CM_2 | CAP | SCS;
+	  mode = CM_2;
 	} else { //disabled
-	  TBCCTL1 = CM_0 | CAP | SCS;
+	  mode = CM_0;
+	}
+	if(rx_state.stage != RX_IDLE) {
+	  /* a frame is ending: keep its capture interrupt, the mode applies after */
+	  rx_state.capture_mode = mode;
+	} else {
+	  /* Disable interrupt */
+	  TBCCTL1 = mode | CAP | SCS;
 	}
-  /* Disable interrupt */
-  TBCCTL1 &= ~CCIE;
   /* Start Timer_B in continuous mode. */
 //  TBCTL |= MC1;
   TBR = RTIMER_NOW();
@@ -721,42 +905,56 @@ uint16_t cc2420_read_sfd_timer(void) {
 /*---------------------------------------------------------------------------*/
 //volatile uint8_t ackbuf[1+ACK_LEN + EXTRA_ACK_LEN]={0}; // = {ACK_LEN + EXTRA_ACK_LEN + AUX_LEN, 0x02, 0x00, seqno, 0x02, 0x1e, ack_status_LSB, ack_status_MSB};
 static uint8_t extrabuf[ACK_LEN]={0};
+/*---------------------------------------------------------------------------*/
+/* Arms the capture interrupt on the falling SFD edge */
+static int
+rx_wait_end(uint8_t stage)
+{
+  rx_state.stage = stage;
+  rx_state.capture_mode = TBCCTL1 & CM_3;
+  TBCCTL1 = (TBCCTL1 & ~(CM_3 | CCIFG)) | CM_2 | CAP | SCS | CCIE;
+  if(!CC2420_SFD_IS_1) {
+    /* The frame ended while we were arming the capture. If the falling
+     * edge was captured, before or after, TBCCR1 holds it */
+    TBCCTL1 &= ~CCIE;
+    if((TBCCTL1 & CCIFG) || (rx_state.capture_mode & CM_2)) {
+      TBCCTL1 &= ~CCIFG;
+      return rx_end_stage(cc2420_read_sfd_timer());
+    }
+    return rx_end_stage(RTIMER_NOW());
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* FIFOP stage */
 int
 cc2420_interrupt(void)
 {
 	COOJA_DEBUG_STR("cc2420_interrupt\n");
 	leds_on(LEDS_RED);
-	struct received_frame_s *last_rf;
-	uint8_t need_ack;
 	uint8_t* ackbuf=NULL;
-	uint8_t nack = 0;
-  uint8_t len, fcf, seqno=0, footer1, is_ack=0, ret = 0;
-  uint8_t len_a, len_b;
-  uint8_t do_ack = 0;
-  uint8_t frame_valid = 0;
+  uint8_t len, seqno=0, ret = 0;
   struct received_frame_s *rf = NULL;
   unsigned char* buf_ptr = NULL;
-  need_ack=0;
 
+  if(rx_state.stage != RX_IDLE) {
+    /* still waiting for the end of the previous frame */
+    CC2420_CLEAR_FIFOP_INT();
+    return 0;
+  }
 #if CC2420_TIMETABLE_PROFILING
   timetable_clear(&cc2420_timetable);
   TIMETABLE_TIMESTAMP(cc2420_timetable, "interrupt");
 #endif /* CC2420_TIMETABLE_PROFILING */
   cc2420_sfd_start_time = cc2420_read_sfd_timer();
   last_packet_timestamp = cc2420_sfd_start_time;
+  /* the frame is still on air */
+  rx_end_time = 0;
   /* If the lock is taken, we cannot access the FIFO. */
   if(locked || need_flush || !CC2420_FIFO_IS_1) {
     need_flush = 1;
-    /* Wait for end of reception */
-    BUSYWAIT_UNTIL(!CC2420_SFD_IS_1, RTIMER_SECOND / 100);
-		COOJA_DEBUG_STR("! locked || need_flush || !CC2420_FIFO_IS_1 end CC2420_SFD_IS_1");
-		rx_end_time = cc2420_read_sfd_timer();
-		off();
-    CC2420_CLEAR_FIFOP_INT();
-  	if(interrupt_exit_callback != NULL) {
-  		interrupt_exit_callback(is_ack, need_ack, last_rf);
-  	}
-  	return 0;
+		COOJA_DEBUG_STR("! locked || need_flush || !CC2420_FIFO_IS_1");
+    return rx_wait_end(RX_DISCARD_UNLOCKED);
   }
 
   GET_LOCK();
@@ -765,47 +963,39 @@ cc2420_interrupt(void)
   	COOJA_DEBUG_STR("! len > CC2420_MAX_PACKET_LEN || len <= AUX_LEN");
     flushrx();
     CC2420_CLEAR_FIFOP_INT();
-    /* Wait for end of reception */
-    BUSYWAIT_UNTIL(!CC2420_SFD_IS_1, RTIMER_SECOND / 100);
-		rx_end_time = cc2420_read_sfd_timer(); //RTIMER_NOW();
-		off();
-    RELEASE_LOCK();
-  	if(interrupt_exit_callback != NULL) {
-  		interrupt_exit_callback(is_ack, need_ack, last_rf);
-  	}
-  	return 0;
+    return rx_wait_end(RX_DISCARD);
   }
 
 	len -= AUX_LEN;
-	/* Allocate space to store the received frame */
-	rf=memb_alloc(&rf_memb);
+	/* Allocate space to store the received frame. It is only listed
+	 * for cc2420_process once complete */
+	rf=rf_alloc();
   if(rf != NULL) {
   	COOJA_DEBUG_STR("irq rf!=NULL memb_alloc ok");
-  	nack = 0;
-  	len_a = len > FIFOP_THRESHOLD ? FIFOP_THRESHOLD : len;
+  	rx_state.nack = 0;
+  	rx_state.len_a = len > FIFOP_THRESHOLD ? FIFOP_THRESHOLD : len;
   	buf_ptr = rf->buf;
 		rf->len = len;
-		list_add(rf_list, rf);
+		rf->timestamp = last_packet_timestamp;
   } else {
   	COOJA_DEBUG_STR("irq rf=NULL");
-  	nack = 1;
+  	rx_state.nack = 1;
   	buf_ptr = extrabuf;
-  	len_a = len > ACK_LEN ? ACK_LEN : len;
+  	rx_state.len_a = len > ACK_LEN ? ACK_LEN : len;
   }
-  len_b = len - len_a;
-	CC2420_READ_FIFO_BUF(buf_ptr, len_a);
+  rx_state.rf = rf;
+  rx_state.len = len;
+	CC2420_READ_FIFO_BUF(buf_ptr, rx_state.len_a);
 
-	fcf = buf_ptr[0];
 	seqno = buf_ptr[2];
-	ret = frame80254_parse_irq(buf_ptr, len_a);
-	do_ack = ret & DO_ACK;
-	is_ack = ret & IS_ACK;
+	ret = frame80254_parse_irq(buf_ptr, rx_state.len_a);
+	rx_state.do_ack = ret & DO_ACK;
+	rx_state.is_ack = ret & IS_ACK;
 
-	if(!is_ack) {
-	  process_poll(&cc2420_process);
+	if(!rx_state.is_ack) {
 		if(softack_make_callback != NULL) { //softack_make_callback
 			COOJA_DEBUG_STR("softACK_make_callback");
-			softack_make_callback(&ackbuf, seqno, last_packet_timestamp, nack);
+			softack_make_callback(&ackbuf, seqno, last_packet_timestamp, rx_state.nack);
 			/* first byte is defines frame length */
 			ackbuf[0] += AUX_LEN;
 		} else { /* construct standard ack */
@@ -818,22 +1008,87 @@ cc2420_interrupt(void)
 		COOJA_DEBUG_STR("softack_make_callback2");
 	}
 
-	if(do_ack && ackbuf[0] > AUX_LEN) {   /* Prepare ack */
+	if(rx_state.do_ack && ackbuf[0] > AUX_LEN) {   /* Prepare ack */
 		COOJA_DEBUG_STR("do_ack");
 		/* Write ack in fifo */
 		CC2420_STROBE(CC2420_SFLUSHTX); /* Flush Tx fifo */
-		//ackbuf[0] = 9;
-//		ack_len = ackbuf[0] - AUX_LEN + 1;
 		CC2420_WRITE_FIFO_BUF(ackbuf, ackbuf[0] - AUX_LEN + 1); // ackbuf[0] - AUX_LEN + 1
 	}
 
-	/* Wait for end of reception */
-  BUSYWAIT_UNTIL(!CC2420_SFD_IS_1, RTIMER_SECOND / 100);
+	return rx_wait_end(RX_FRAME);
+}
+/*---------------------------------------------------------------------------*/
+/* SFD stage: to be called from the timer B interrupt when TBCCR1 captured */
+int
+cc2420_sfd_interrupt(void)
+{
+  if(rx_state.stage == RX_IDLE) {
+    return 0;
+  }
+  TBCCTL1 &= ~(CCIE | CCIFG);
+  return rx_end_stage(cc2420_read_sfd_timer());
+}
+/*---------------------------------------------------------------------------*/
+/* Gives up the frame being received when its end was never captured:
+ * without this, a missed SFD interrupt leaves the FIFO locked for good */
+static void
+cc2420_rx_abort(void)
+{
+  int s = splhigh();
+  uint8_t stage = rx_state.stage;
 
+  if(stage == RX_IDLE) {
+    splx(s);
+    return;
+  }
+  rx_state.stage = RX_IDLE;
+  TBCCTL1 = (TBCCTL1 & ~(CM_3 | CCIE | CCIFG)) | rx_state.capture_mode;
+  off();
+  if(stage == RX_FRAME) {
+    if(rx_state.do_ack) {
+      CC2420_STROBE(CC2420_SFLUSHTX); /* Flush Tx fifo */
+    }
+    if(rx_state.rf) {
+      rf_free(rx_state.rf);
+    }
+    flushrx();
+  }
+  CC2420_CLEAR_FIFOP_INT();
+  if(stage != RX_DISCARD_UNLOCKED) {
+    RELEASE_LOCK();
+  }
+  splx(s);
+  COOJA_DEBUG_STR("cc2420_rx_abort");
+}
+/*---------------------------------------------------------------------------*/
+static int
+rx_end_stage(uint16_t end_time)
+{
+	struct received_frame_s *rf = rx_state.rf;
+	struct received_frame_s *last_rf = NULL;
+	uint8_t need_ack = 0, frame_valid = 0, footer0, footer1;
+	uint8_t len = rx_state.len, len_b = rx_state.len - rx_state.len_a;
+	uint8_t stage = rx_state.stage;
+
+	rx_state.stage = RX_IDLE;
+	TBCCTL1 = (TBCCTL1 & ~CM_3) | rx_state.capture_mode;
 	COOJA_DEBUG_STR("end CC2420_SFD_IS_1");
-	//read time of down edge of SFD
-	rx_end_time = cc2420_read_sfd_timer();
+	//time of down edge of SFD
+	rx_end_time = end_time;
 	off();
+
+	if(stage != RX_FRAME) {
+		if(stage == RX_DISCARD_UNLOCKED) {
+			CC2420_CLEAR_FIFOP_INT();
+		} else {
+			RELEASE_LOCK();
+		}
+		if(interrupt_exit_callback != NULL) {
+			interrupt_exit_callback(0, 0, NULL);
+		}
+		return 0;
+	}
+
 	/* XXX rx_end_time should not be 0 */
 	if(!rx_end_time) {
 		rx_end_time++;
@@ -844,25 +1099,34 @@ cc2420_interrupt(void)
 	CC2420_READ_RAM_BYTE(footer1, RXFIFO_ADDR(len + AUX_LEN));
 
 	if(!overflow && (footer1 & FOOTER1_CRC_OK)) { /* CRC is correct */
-		if(rf && len_b>0) { /* Get rest of the data.
-		 No need to read the footer; we already checked it in place
-		 before acking. */
-			CC2420_READ_FIFO_BUF(rf->buf + len_a, len_b);
+		CC2420_READ_RAM_BYTE(footer0, RXFIFO_ADDR(len + AUX_LEN - 1));
+		cc2420_last_rssi = footer0;
+		cc2420_last_correlation = footer1 & FOOTER1_CORRELATION;
+		if(rf) {
+			rf->rssi = footer0;
+			if(len_b>0) { /* Get rest of the data.
+			 No need to read the footer; we already checked it in place
+			 before acking. */
+				CC2420_READ_FIFO_BUF(rf->buf + rx_state.len_a, len_b);
+			}
+			extract_sender_address(rf);
+			list_add(rf_list, rf);
+			if(!rx_state.is_ack) {
+				process_poll(&cc2420_process);
+			}
 		}
-		extract_sender_address(rf);
 		frame_valid = 1;
 	} else { /* CRC is wrong */
-		if(do_ack) {
+		if(rx_state.do_ack) {
 			CC2420_STROBE(CC2420_SFLUSHTX); /* Flush Tx fifo */
 		}
 		if(rf) {
-			list_chop(rf_list);
-			memb_free(&rf_memb, rf);
+			rf_free(rf);
 			rf = NULL;
 		}
 	}
 	last_rf = (frame_valid) ? rf : NULL;
-	need_ack = (frame_valid && do_ack) ? 1 + nack : 0;
+	need_ack = (frame_valid && rx_state.do_ack) ? 1 + rx_state.nack : 0;
 
   /* Flush rx fifo (because we're doing direct FIFO addressing and
    * we don't want to lose track of where we are in the FIFO) */
@@ -871,7 +1135,7 @@ cc2420_interrupt(void)
   RELEASE_LOCK();
   COOJA_DEBUG_STR("cc2420_interrupt end\n");
 	if(interrupt_exit_callback != NULL) {
-		interrupt_exit_callback(is_ack, need_ack, last_rf);
+		interrupt_exit_callback(rx_state.is_ack, need_ack, last_rf);
 	}
 	return 1;
 }
@@ -892,17 +1156,25 @@ int
 cc2420_read_ack(void *buf, int alen) {
   GET_LOCK();
   BUSYWAIT_UNTIL(!CC2420_SFD_IS_1, RTIMER_SECOND / 100);
-  int len, footer1;
+  int len, footer0, footer1;
   CC2420_READ_FIFO_BYTE(len);
   if(buf && len>0) {
   	alen = (len > alen) ? alen : len ;
   	COOJA_DEBUG_STR("ACK len>0");
 		int overflow = CC2420_FIFOP_IS_1 && !CC2420_FIFO_IS_1;
-		CC2420_READ_RAM_BYTE(footer1, RXFIFO_ADDR(len + AUX_LEN));
+		/* len is the PHY length: it already counts the two footer bytes */
+		CC2420_READ_RAM_BYTE(footer1, RXFIFO_ADDR(len));
 		if(!overflow && (footer1 & FOOTER1_CRC_OK)) { /* CRC is correct */
 	  	COOJA_DEBUG_STR("ACK !overflow && (footer1 & FOOTER1_CRC_OK)");
-			CC2420_READ_FIFO_BUF(buf, len);
-			len = (((uint8_t*)buf)[0] & 7) == FRAME802154_ACKFRAME ? len : -1;
+			CC2420_READ_RAM_BYTE(footer0, RXFIFO_ADDR(len - 1));
+			cc2420_last_rssi = footer0;
+			cc2420_last_correlation = footer1 & FOOTER1_CORRELATION;
+			/* never read more than the caller's buffer; the rest (footer) is flushed */
+			CC2420_READ_FIFO_BUF(buf, alen);
+			if(alen < len) {
+				flushrx();
+			}
+			len = (((uint8_t*)buf)[0] & 7) == FRAME802154_ACKFRAME ? alen : -1;
 		} else {
 			len = 0;
 		}
@@ -912,8 +1184,35 @@ cc2420_read_ack(void *buf, int alen) {
   return len;
 }
 /*---------------------------------------------------------------------------*/
+/* Takes the oldest received frame out of the list. It stays allocated
+ * until release_frame(). The end-of-frame interrupt may come at any time,
+ * even while we hold the lock: interrupts are off around the list and
+ * pool operations */
+static struct received_frame_s *
+pop_frame(void)
+{
+  struct received_frame_s *rf;
+  int s = splhigh();
+  rf = list_pop(rf_list);
+  if(rf != NULL && list_head(rf_list) != NULL) {
+    /* If there are other packets pending, poll */
+    process_poll(&cc2420_process);
+  }
+  splx(s);
+  return rf;
+}
+/*---------------------------------------------------------------------------*/
+static void
+release_frame(struct received_frame_s *rf)
+{
+  int s = splhigh();
+  rf_free(rf);
+  splx(s);
+}
+/*---------------------------------------------------------------------------*/
 PROCESS_THREAD(cc2420_process, ev, data)
 {
+  static struct received_frame_s *rf;
   int len;
   PROCESS_BEGIN();
 
@@ -936,15 +1235,26 @@ PROCESS_THREAD(cc2420_process, ev, data)
       COOJA_DEBUG_STR("cc2420_process: need_flush\n");
     }
 
-    packetbuf_clear();
-    packetbuf_set_attr(PACKETBUF_ATTR_TIMESTAMP, last_packet_timestamp);
-    len = cc2420_read(packetbuf_dataptr(), PACKETBUF_SIZE);
-
-    int frame_type = ((uint8_t*)packetbuf_dataptr())[0] & 7;
-    if(frame_type == FRAME802154_ACKFRAME) {
-      len = 0;
+    /* The frame is looked at in the RX pool: ACKs and the frames the
+     * subscriber consumes never reach packetbuf. The others are copied
+     * once, and their pool entry is released before the upper layers run */
+    rf = pop_frame();
+    if(rf == NULL) {
+      continue;
     }
+    if((rf->buf[0] & 7) == FRAME802154_ACKFRAME
+        || (rx_frame_callback != NULL
+            && rx_frame_callback(rf->buf, rf->len, rf->timestamp, rf->rssi))) {
+      release_frame(rf);
+      continue;
+    }
+    packetbuf_clear();
+    len = rf->len;
+    memcpy(packetbuf_dataptr(), rf->buf, len);
     packetbuf_set_datalen(len);
+    packetbuf_set_attr(PACKETBUF_ATTR_TIMESTAMP, rf->timestamp);
+    packetbuf_set_attr(PACKETBUF_ATTR_RSSI, rf->rssi);
+    release_frame(rf);
 
     NETSTACK_RDC.input();
 
@@ -962,30 +1272,21 @@ PROCESS_THREAD(cc2420_process, ev, data)
 static int
 cc2420_read(void *buf, unsigned short bufsize)
 {
-  GET_LOCK();
   COOJA_DEBUG_STR("cc2420_read \n");
 
-  struct received_frame_s *rf = list_pop(rf_list);
+  struct received_frame_s *rf = pop_frame();
   if(rf == NULL) {
-    RELEASE_LOCK();
     COOJA_DEBUG_STR("cc2420_read rf == NULL\n");
     return 0;
   } else {
-    if(list_head(rf_list) != NULL) {
-      COOJA_DEBUG_STR("cc2420_read list_head(rf_list) != NULL\n");
-      /* If there are other packets pending, poll */
-      process_poll(&cc2420_process);
-    }
     int len = rf->len;
     if(len > bufsize) {
-      memb_free(&rf_memb, rf);
-      RELEASE_LOCK();
+      release_frame(rf);
       COOJA_DEBUG_STR("cc2420_read len > bufsize\n");
       return 0;
     }
     memcpy(buf, rf->buf, len);
-    memb_free(&rf_memb, rf);
-    RELEASE_LOCK();
+    release_frame(rf);
     return len;
   }
 }
@@ -1135,3 +1436,36 @@ cc2420_pending_irq(void)
 {
   return CC2420_FIFO_IS_1;
 }
+/*---------------------------------------------------------------------------*/
+static int8_t
+get_last_rssi(void)
+{
+  return cc2420_last_rssi;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t
+get_last_correlation(void)
+{
+  return cc2420_last_correlation;
+}
+/*---------------------------------------------------------------------------*/
+const struct tsch_radio_driver cc2420_tsch_radio =
+  {
+    "cc2420",
+    cc2420_softack_subscribe,
+    cc2420_rx_subscribe,
+    cc2420_get_rx_end_time,
+    cc2420_rx_abort,
+    cc2420_get_tx_start_time,
+    cc2420_get_tx_end_time,
+    cc2420_send_ack,
+    cc2420_read_ack,
+    cc2420_pending_irq,
+    cc2420_address_decode,
+    cc2420_sfd_sync,
+    cc2420_read_sfd_timer,
+    cc2420_set_channel,
+    get_last_rssi,
+    get_last_correlation,
+  };
+/*---------------------------------------------------------------------------*/
@@ -46,6 +46,7 @@
 #include "dev/radio.h"
 #include "dev/cc2420_const.h"
 #include "rimeaddr.h"
+#include "tsch-radio.h"
 
 int cc2420_init(void);
 //Timesync IE length with header = 4
@@ -58,16 +59,20 @@ int cc2420_init(void);
 #define FOOTER_LEN 2
 #define AUX_LEN (CHECKSUM_LEN + FOOTER_LEN)
 
-#define ACK_LEN 3
-#define EXTRA_ACK_LEN 4
 #define CC2420_MAX_PACKET_LEN      127
-struct received_frame_s {
-  struct received_frame_s *next;
-  uint8_t buf[CC2420_MAX_PACKET_LEN];
-  uint8_t len;
-  rimeaddr_t source_address;
+
+/* Occupancy of the RX frame pool (CC2420_CONF_RX_POOL_SIZE entries) */
+struct cc2420_rx_pool_stats {
+  uint16_t allocs;  /* frames stored in the pool */
+  uint16_t nacks;   /* frames dropped, and NACKed, because the pool was full */
+  uint8_t in_use;   /* frames waiting for cc2420_process */
+  uint8_t peak;     /* highest in_use seen */
 };
 
+const struct cc2420_rx_pool_stats *cc2420_get_rx_pool_stats(void);
+/* Clears the counters; the peak restarts from the current occupancy */
+void cc2420_reset_rx_pool_stats(void);
+
 int cc2420_set_channel(int channel);
 int cc2420_get_channel(void);
 
@@ -81,6 +86,8 @@ extern uint8_t cc2420_last_correlation;
 int cc2420_rssi(void);
 
 extern const struct radio_driver cc2420_driver;
+/* The TSCH radio interface of the driver */
+extern const struct tsch_radio_driver cc2420_tsch_radio;
 
 /**
  * \param power Between 1 and 31.
@@ -95,6 +102,12 @@ int cc2420_get_txpower(void);
  *
  */
 int cc2420_interrupt(void);
+/**
+ * End-of-frame interrupt function, to be called from the timer B
+ * interrupt when TBCCR1 captured the falling SFD edge. A reception
+ * started by cc2420_interrupt() completes here.
+ */
+int cc2420_sfd_interrupt(void);
 
 /* XXX hack: these will be made as Chameleon packet attributes */
 extern rtimer_clock_t cc2420_time_of_arrival,
@@ -109,12 +122,14 @@ void cc2420_set_cca_threshold(int value);
 /************************************************************************/
 /* Additional low-level functions for the CC2420 */
 /************************************************************************/
-typedef void(softack_make_callback_f)(uint8_t **ackbuf, uint8_t seqno, rtimer_clock_t last_packet_timestamp, uint8_t nack);
-typedef void(softack_interrupt_exit_callback_f)(uint8_t is_ack, uint8_t need_ack, struct received_frame_s * last_rf);
-
 /* Subscribe with two callbacks called from FIFOP interrupt */
 void cc2420_softack_subscribe(softack_make_callback_f *softack_make, softack_interrupt_exit_callback_f *interrupt_exit);
+/* Subscribe with a callback called from cc2420_process with a frame still
+ * in the RX pool; a frame it consumes is never copied to packetbuf */
+void cc2420_rx_subscribe(rx_frame_callback_f *rx_frame);
 rtimer_clock_t cc2420_get_rx_end_time(void);
+rtimer_clock_t cc2420_get_tx_start_time(void);
+rtimer_clock_t cc2420_get_tx_end_time(void);
 void cc2420_arch_init(void);
 void cc2420_send_ack(void);
 int cc2420_read_ack(void *buf, int);
@@ -125,16 +140,6 @@ void cc2420_sfd_sync(uint8_t capture_start_sfd,
 		uint8_t capture_end_sfd);
 uint16_t cc2420_read_sfd_timer(void);
 
-#define NETSTACK_RADIO_softack_subscribe 	cc2420_softack_subscribe
-#define NETSTACK_RADIO_get_rx_end_time 		cc2420_get_rx_end_time
-#define NETSTACK_RADIO_send_ack 					cc2420_send_ack
-#define NETSTACK_RADIO_read_ack 					cc2420_read_ack
-#define NETSTACK_RADIO_pending_irq 				cc2420_pending_irq
-#define NETSTACK_RADIO_address_decode 		cc2420_address_decode
-#define NETSTACK_RADIO_sfd_sync 					cc2420_sfd_sync
-#define NETSTACK_RADIO_read_sfd_timer 		cc2420_read_sfd_timer
-#define NETSTACK_RADIO_set_channel 				cc2420_set_channel
-
 /************************************************************************/
 /* Additional SPI Macros for the CC2420 */
 /************************************************************************/
@@ -185,6 +190,45 @@ uint16_t cc2420_read_sfd_timer(void);
     CC2420_SPI_DISABLE();                               \
   } while(0)
 
+/* FIFO transfers through the MSP430 DMA controller on USART0: DMA0 moves
+ * received bytes (URXIFG0 trigger), DMA1 feeds the transmitter (UTXIFG0
+ * trigger). Short transfers stay polled: they are cheaper than the setup */
+#ifndef CC2420_CONF_SPI_DMA
+#define CC2420_CONF_SPI_DMA 0
+#endif /* CC2420_CONF_SPI_DMA */
+#ifndef CC2420_CONF_SPI_DMA_MIN_LEN
+#define CC2420_CONF_SPI_DMA_MIN_LEN 8
+#endif /* CC2420_CONF_SPI_DMA_MIN_LEN */
+/* Bound on a DMA transfer, after which the rest is polled. A full frame
+ * takes well under a millisecond on the SPI */
+#ifndef CC2420_CONF_SPI_DMA_TIMEOUT
+#define CC2420_CONF_SPI_DMA_TIMEOUT (RTIMER_SECOND / 500)
+#endif /* CC2420_CONF_SPI_DMA_TIMEOUT */
+
+#if CC2420_CONF_SPI_DMA
+void cc2420_spi_dma_init(void);
+void cc2420_spi_dma_read(uint8_t *buf, uint8_t count);
+void cc2420_spi_dma_write(const uint8_t *buf, uint8_t count);
+
+#define CC2420_READ_FIFO_BUF(buffer,count)                                 \
+  do {                                                                  \
+    CC2420_SPI_ENABLE();                                                \
+    SPI_WRITE(CC2420_RXFIFO | 0x40);                                    \
+    (void)SPI_RXBUF;                                                    \
+    cc2420_spi_dma_read((uint8_t *)(buffer), (count));                  \
+    clock_delay(1);                                                     \
+    CC2420_SPI_DISABLE();                                               \
+  } while(0)
+
+#define CC2420_WRITE_FIFO_BUF(buffer,count)                                \
+  do {                                                                  \
+    CC2420_SPI_ENABLE();                                                \
+    SPI_WRITE_FAST(CC2420_TXFIFO);                                      \
+    cc2420_spi_dma_write((const uint8_t *)(buffer), (count));           \
+    SPI_WAITFORTx_ENDED();                                              \
+    CC2420_SPI_DISABLE();                                               \
+  } while(0)
+#else /* CC2420_CONF_SPI_DMA */
 #define CC2420_READ_FIFO_BUF(buffer,count)                                 \
   do {                                                                  \
     uint8_t i;                                                          \
@@ -209,6 +253,7 @@ uint16_t cc2420_read_sfd_timer(void);
     SPI_WAITFORTx_ENDED();                                              \
     CC2420_SPI_DISABLE();                                               \
   } while(0)
+#endif /* CC2420_CONF_SPI_DMA */
 
 /* Write to RAM in the CC2420 */
 #define CC2420_WRITE_RAM(buffer,adr,count)                 \
@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2014, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Software mock of the TSCH radio
+ */
+
+#include <string.h>
+
+#include "contiki.h"
+#include "net/packetbuf.h"
+#include "net/netstack.h"
+#include "net/mac/frame802154.h"
+#include "lib/memb.h"
+#include "lib/list.h"
+#include "dev/tsch-radio-mock.h"
+
+/* Airtime in rtimer ticks of a frame of len bytes: 32us per byte, plus
+ * preamble, SFD, length and FCS */
+#define AIRTIME(len) ((rtimer_clock_t)(((uint32_t)(len) + 6 + TSCH_FCS_LEN) \
+      * 32 * RTIMER_SECOND / 1000000))
+
+#define FRAME_DO_ACK(buf) (((buf)[0] >> 5) & 1)
+#define FRAME_TYPE(buf) ((buf)[0] & 7)
+
+static softack_make_callback_f *softack_make_callback = NULL;
+static softack_interrupt_exit_callback_f *interrupt_exit_callback = NULL;
+static rx_frame_callback_f *rx_frame_callback = NULL;
+
+static uint8_t receive_on;
+static int channel;
+static int8_t last_rssi;
+static uint8_t last_correlation;
+static int8_t link_rssi = -50;
+static uint8_t link_lqi = 105;
+
+static uint8_t capture_start, capture_end;
+static rtimer_clock_t rx_end_time, tx_start_time, tx_end_time;
+static uint16_t sfd_timer;
+
+/* the frame to send, and the last one sent */
+static uint8_t tx_buf[TSCH_MAX_PACKET_LEN];
+static uint8_t tx_len;
+static uint8_t *ack_to_send;
+static uint8_t last_tx_buf[TSCH_MAX_PACKET_LEN];
+static uint8_t last_tx_len;
+static int last_tx_channel;
+
+MEMB(rf_memb, struct received_frame_s, 2);
+LIST(rf_list);
+
+PROCESS(tsch_radio_mock_process, "TSCH radio mock");
+/*---------------------------------------------------------------------------*/
+static void
+sent(const uint8_t *buf, uint8_t len)
+{
+  memcpy(last_tx_buf, buf, len);
+  last_tx_len = len;
+  last_tx_channel = channel;
+}
+/*---------------------------------------------------------------------------*/
+int
+tsch_radio_mock_receive(const uint8_t *buf, uint8_t len, rtimer_clock_t sfd_time)
+{
+  struct received_frame_s *rf;
+  uint8_t *ackbuf = NULL;
+  uint8_t is_ack, nack, need_ack = 0;
+
+  if(!receive_on || len < ACK_LEN || len > TSCH_MAX_PACKET_LEN) {
+    return 0;
+  }
+  if(capture_start) {
+    sfd_timer = sfd_time;
+  }
+  is_ack = FRAME_TYPE(buf) == FRAME802154_ACKFRAME;
+  rf = memb_alloc(&rf_memb);
+  nack = rf == NULL;
+  if(!is_ack && FRAME_DO_ACK(buf) && softack_make_callback != NULL) {
+    softack_make_callback(&ackbuf, buf[2], sfd_time, nack);
+    ack_to_send = ackbuf;
+    need_ack = 1 + nack;
+  }
+  rx_end_time = sfd_time + AIRTIME(len);
+  if(!rx_end_time) {
+    rx_end_time++;
+  }
+  if(capture_end) {
+    sfd_timer = rx_end_time;
+  }
+  last_rssi = link_rssi;
+  last_correlation = link_lqi;
+  if(rf != NULL) {
+    memcpy(rf->buf, buf, len);
+    rf->len = len;
+    rf->timestamp = sfd_time;
+    rf->rssi = link_rssi;
+    memset(&rf->source_address, 0, sizeof(rimeaddr_t));
+    if(len >= 3 + 2 + 8 + 8 && (buf[0] & 0x40) && (buf[1] & 0xcc) == 0xcc) {
+      /* long destination and source, PAN ID compressed */
+      uint8_t i;
+      for(i = 0; i < 8; i++) {
+        rf->source_address.u8[i] = buf[3 + 2 + 8 + 7 - i];
+      }
+    }
+    list_add(rf_list, rf);
+    if(!is_ack) {
+      process_poll(&tsch_radio_mock_process);
+    }
+  }
+  /* like the real radio, stop listening after a frame */
+  receive_on = 0;
+  if(interrupt_exit_callback != NULL) {
+    interrupt_exit_callback(is_ack, need_ack, rf);
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_radio_mock_set_link(int8_t rssi, uint8_t lqi)
+{
+  link_rssi = rssi;
+  link_lqi = lqi;
+}
+/*---------------------------------------------------------------------------*/
+const uint8_t *
+tsch_radio_mock_last_tx(uint8_t *len, int *chan)
+{
+  *len = last_tx_len;
+  *chan = last_tx_channel;
+  return last_tx_buf;
+}
+/*---------------------------------------------------------------------------*/
+int
+tsch_radio_mock_get_channel(void)
+{
+  return channel;
+}
+/*---------------------------------------------------------------------------*/
+static struct received_frame_s *
+pop_frame(void)
+{
+  struct received_frame_s *rf = list_pop(rf_list);
+  if(rf != NULL && list_head(rf_list) != NULL) {
+    process_poll(&tsch_radio_mock_process);
+  }
+  return rf;
+}
+/*---------------------------------------------------------------------------*/
+/* radio_driver */
+static int
+init(void)
+{
+  memb_init(&rf_memb);
+  list_init(rf_list);
+  process_start(&tsch_radio_mock_process, NULL);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+prepare(const void *payload, unsigned short payload_len)
+{
+  if(payload_len > TSCH_MAX_PACKET_LEN) {
+    return 1;
+  }
+  memcpy(tx_buf, payload, payload_len);
+  tx_len = payload_len;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+transmit(unsigned short transmit_len)
+{
+  if(tx_len == 0) {
+    return RADIO_TX_ERR;
+  }
+  tx_start_time = RTIMER_NOW();
+  tx_end_time = tx_start_time + AIRTIME(tx_len);
+  if(capture_start) {
+    sfd_timer = tx_start_time;
+  }
+  if(capture_end) {
+    sfd_timer = tx_end_time;
+  }
+  sent(tx_buf, tx_len);
+  receive_on = 0;
+  return RADIO_TX_OK;
+}
+/*---------------------------------------------------------------------------*/
+static int
+send(const void *payload, unsigned short payload_len)
+{
+  prepare(payload, payload_len);
+  return transmit(payload_len);
+}
+/*---------------------------------------------------------------------------*/
+static int
+read(void *buf, unsigned short bufsize)
+{
+  struct received_frame_s *rf = pop_frame();
+  int len = 0;
+  if(rf != NULL) {
+    if(rf->len <= bufsize) {
+      len = rf->len;
+      memcpy(buf, rf->buf, len);
+    }
+    memb_free(&rf_memb, rf);
+  }
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+static int
+channel_clear(void)
+{
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+receiving_packet(void)
+{
+  /* frames arrive whole */
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+pending_packet(void)
+{
+  return list_head(rf_list) != NULL;
+}
+/*---------------------------------------------------------------------------*/
+static int
+on(void)
+{
+  receive_on = 1;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+off(void)
+{
+  receive_on = 0;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+const struct radio_driver tsch_radio_mock_driver =
+  {
+    init,
+    prepare,
+    transmit,
+    send,
+    read,
+    channel_clear,
+    receiving_packet,
+    pending_packet,
+    on,
+    off,
+  };
+/*---------------------------------------------------------------------------*/
+/* Delivers received frames, as the driver process of a real radio */
+PROCESS_THREAD(tsch_radio_mock_process, ev, data)
+{
+  static struct received_frame_s *rf;
+  PROCESS_BEGIN();
+
+  while(1) {
+    PROCESS_YIELD_UNTIL(ev == PROCESS_EVENT_POLL);
+    rf = pop_frame();
+    if(rf == NULL) {
+      continue;
+    }
+    if(FRAME_TYPE(rf->buf) == FRAME802154_ACKFRAME
+        || (rx_frame_callback != NULL
+            && rx_frame_callback(rf->buf, rf->len, rf->timestamp, rf->rssi))) {
+      memb_free(&rf_memb, rf);
+      continue;
+    }
+    packetbuf_clear();
+    memcpy(packetbuf_dataptr(), rf->buf, rf->len);
+    packetbuf_set_datalen(rf->len);
+    packetbuf_set_attr(PACKETBUF_ATTR_TIMESTAMP, rf->timestamp);
+    packetbuf_set_attr(PACKETBUF_ATTR_RSSI, rf->rssi);
+    memb_free(&rf_memb, rf);
+    NETSTACK_RDC.input();
+  }
+
+  PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+/* tsch_radio_driver */
+static void
+softack_subscribe(softack_make_callback_f *softack_make,
+                  softack_interrupt_exit_callback_f *interrupt_exit)
+{
+  softack_make_callback = softack_make;
+  interrupt_exit_callback = interrupt_exit;
+}
+/*---------------------------------------------------------------------------*/
+static void
+rx_subscribe(rx_frame_callback_f *rx_frame)
+{
+  rx_frame_callback = rx_frame;
+}
+/*---------------------------------------------------------------------------*/
+static rtimer_clock_t
+get_rx_end_time(void)
+{
+  return rx_end_time;
+}
+/*---------------------------------------------------------------------------*/
+static void
+rx_abort(void)
+{
+  /* tsch_radio_mock_receive() delivers whole frames: none is ever left pending */
+}
+/*---------------------------------------------------------------------------*/
+static rtimer_clock_t
+get_tx_start_time(void)
+{
+  return tx_start_time;
+}
+/*---------------------------------------------------------------------------*/
+static rtimer_clock_t
+get_tx_end_time(void)
+{
+  return tx_end_time;
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_ack(void)
+{
+  /* the first byte of a soft ACK is its length */
+  if(ack_to_send != NULL) {
+    sent(&ack_to_send[1], ack_to_send[0]);
+    ack_to_send = NULL;
+  }
+  receive_on = 0;
+  rx_end_time = 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+read_ack(void *buf, int len)
+{
+  return read(buf, len);
+}
+/*---------------------------------------------------------------------------*/
+static int
+pending_irq(void)
+{
+  /* there is no FIFO: received frames are listed at once */
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+address_decode(uint8_t enable)
+{
+}
+/*---------------------------------------------------------------------------*/
+static void
+sfd_sync(uint8_t capture_start_sfd, uint8_t capture_end_sfd)
+{
+  capture_start = capture_start_sfd;
+  capture_end = capture_end_sfd;
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+read_sfd_timer(void)
+{
+  return sfd_timer;
+}
+/*---------------------------------------------------------------------------*/
+static int
+set_channel(int c)
+{
+  if(c < 11 || c > 26) {
+    return 0;
+  }
+  channel = c;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int8_t
+get_last_rssi(void)
+{
+  return last_rssi;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t
+get_last_correlation(void)
+{
+  return last_correlation;
+}
+/*---------------------------------------------------------------------------*/
+const struct tsch_radio_driver tsch_radio_mock =
+  {
+    "mock",
+    softack_subscribe,
+    rx_subscribe,
+    get_rx_end_time,
+    rx_abort,
+    get_tx_start_time,
+    get_tx_end_time,
+    send_ack,
+    read_ack,
+    pending_irq,
+    address_decode,
+    sfd_sync,
+    read_sfd_timer,
+    set_channel,
+    get_last_rssi,
+    get_last_correlation,
+  };
+/*---------------------------------------------------------------------------*/
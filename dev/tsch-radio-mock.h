@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2014, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Software mock of the TSCH radio, for running and benchmarking
+ *         the MAC natively. Frames are injected with
+ *         tsch_radio_mock_receive() and transmitted ones are kept for
+ *         inspection; timestamps are computed from rtimer and airtime.
+ */
+
+#ifndef __TSCH_RADIO_MOCK_H__
+#define __TSCH_RADIO_MOCK_H__
+
+#include "contiki.h"
+#include "dev/radio.h"
+#include "tsch-radio.h"
+
+/* Use with NETSTACK_CONF_RADIO tsch_radio_mock_driver and TSCH_CONF_RADIO
+ * tsch_radio_mock, with tsch-radio-mock.c in CONTIKI_SOURCEFILES */
+extern const struct radio_driver tsch_radio_mock_driver;
+extern const struct tsch_radio_driver tsch_radio_mock;
+
+/* Receives a frame whose SFD was at sfd_time, as the RX interrupt of a
+ * real radio would: makes its ACK and calls the interrupt exit callback.
+ * Returns 0 if the radio was off */
+int tsch_radio_mock_receive(const uint8_t *buf, uint8_t len, rtimer_clock_t sfd_time);
+/* Sets the RSSI and LQI reported for the frames received next */
+void tsch_radio_mock_set_link(int8_t rssi, uint8_t lqi);
+/* Last frame or ACK transmitted, and its channel */
+const uint8_t *tsch_radio_mock_last_tx(uint8_t *len, int *channel);
+/* Current channel, 0 if never set */
+int tsch_radio_mock_get_channel(void);
+
+#endif /* __TSCH_RADIO_MOCK_H__ */
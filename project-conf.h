@@ -22,6 +22,13 @@
 #undef NETSTACK_CONF_RDC
 #define NETSTACK_CONF_RDC     tschrdc_driver
 
+/* make TARGET=native: the radio is dev/tsch-radio-mock.c */
+#if TSCH_CONF_RADIO_MOCK
+#undef NETSTACK_CONF_RADIO
+#define NETSTACK_CONF_RADIO   tsch_radio_mock_driver
+#define TSCH_CONF_RADIO tsch_radio_mock
+#endif /* TSCH_CONF_RADIO_MOCK */
+
 #undef UIP_CONF_ND6_SEND_NA
 #define UIP_CONF_ND6_SEND_NA 0
 
@@ -34,5 +41,9 @@
 #undef NBR_TABLE_CONF_MAX_NEIGHBORS
 #define NBR_TABLE_CONF_MAX_NEIGHBORS	20
 
+/* RPL takes its link metric from the TSCH ETX estimator */
+#undef RPL_CONF_OF
+#define RPL_CONF_OF tsch_rpl_of
+
 #endif /* PROJECT_H_ */
 
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2014, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Division-free conversions between rtimer ticks (32768 Hz) and
+ *         microseconds, cheap enough for the ACK interrupt path.
+ *
+ *         One tick is exactly 15625/512 us, so ticks -> us is a multiply
+ *         and a shift. The other way is a multiply by the precomputed
+ *         reciprocal 2^21 * 512/15625 = 2^30/15625 ~= 68719.48, truncated
+ *         to 68719, and a shift, which is off by about 7 ppm (< 0.25 us
+ *         over the 2^15 us input range).
+ */
+
+#ifndef __TSCH_CONVERSION_H__
+#define __TSCH_CONVERSION_H__
+
+#include "contiki-conf.h"
+
+#define TSCH_US_PER_TICK_NUM 15625UL
+#define TSCH_US_PER_TICK_SHIFT 9
+#define TSCH_TICKS_PER_US_RECIPROCAL 68719UL
+#define TSCH_TICKS_PER_US_SHIFT 21
+
+/* Ticks to microseconds, rounded. Valid for |ticks| < 2^18 */
+static inline int32_t
+tsch_ticks_to_us(int32_t ticks)
+{
+	if(ticks >= 0) {
+		return ((uint32_t)ticks * TSCH_US_PER_TICK_NUM
+				+ (1UL << (TSCH_US_PER_TICK_SHIFT - 1))) >> TSCH_US_PER_TICK_SHIFT;
+	}
+	return -(int32_t)(((uint32_t)-ticks * TSCH_US_PER_TICK_NUM
+			+ (1UL << (TSCH_US_PER_TICK_SHIFT - 1))) >> TSCH_US_PER_TICK_SHIFT);
+}
+
+/* Microseconds to 1/2^frac_bits ticks, rounded. Valid for |us| < 2^15
+ * and frac_bits < TSCH_TICKS_PER_US_SHIFT */
+static inline int32_t
+tsch_us_to_ticks_frac(int32_t us, uint8_t frac_bits)
+{
+	uint8_t shift = TSCH_TICKS_PER_US_SHIFT - frac_bits;
+	if(us >= 0) {
+		return ((uint32_t)us * TSCH_TICKS_PER_US_RECIPROCAL + (1UL << (shift - 1))) >> shift;
+	}
+	return -(int32_t)(((uint32_t)-us * TSCH_TICKS_PER_US_RECIPROCAL + (1UL << (shift - 1))) >> shift);
+}
+
+/* Microseconds to ticks, rounded. Valid for |us| < 2^15 */
+#define tsch_us_to_ticks(us) tsch_us_to_ticks_frac((us), 0)
+
+#endif /* __TSCH_CONVERSION_H__ */
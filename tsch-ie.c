@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2014, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         IEEE 802.15.4e Information Elements, parsed in place.
+ */
+
+#include "contiki.h"
+#include "tsch-ie.h"
+
+/*---------------------------------------------------------------------------*/
+void
+tsch_ie_iterator_init(struct tsch_ie_iterator *it,
+		const uint8_t *buf, uint16_t len, uint8_t level)
+{
+	it->pos = buf;
+	it->end = buf + len;
+	it->level = level;
+}
+/*---------------------------------------------------------------------------*/
+int
+tsch_ie_next(struct tsch_ie_iterator *it, struct tsch_ie *ie)
+{
+	uint16_t desc;
+
+	if(it->end - it->pos < TSCH_IE_DESCRIPTOR_LEN) {
+		return 0;
+	}
+	desc = it->pos[0] | (it->pos[1] << 8);
+	switch(it->level) {
+	case TSCH_IE_HEADER:
+		ie->len = desc & 0x7f;
+		ie->id = (desc >> 7) & 0xff;
+		break;
+	case TSCH_IE_PAYLOAD:
+		ie->len = desc & 0x07ff;
+		ie->id = (desc >> 11) & 0x0f;
+		break;
+	default:
+		if(desc & 0x8000) {
+			ie->len = desc & 0x07ff;
+			ie->id = TSCH_IE_LONG | ((desc >> 11) & 0x0f);
+		} else {
+			ie->len = desc & 0xff;
+			ie->id = (desc >> 8) & 0x7f;
+		}
+		break;
+	}
+	ie->content = it->pos + TSCH_IE_DESCRIPTOR_LEN;
+	if(it->end - ie->content < ie->len) {
+		/* truncated: stop here */
+		it->pos = it->end;
+		return 0;
+	}
+	it->pos = ie->content + ie->len;
+	if(it->level == TSCH_IE_HEADER
+			&& (ie->id == TSCH_IE_HEADER_TERMINATION_1 || ie->id == TSCH_IE_HEADER_TERMINATION_2)) {
+		/* no more header IEs: the caller continues from it->pos */
+		it->end = it->pos;
+	} else if(it->level == TSCH_IE_PAYLOAD && ie->id == TSCH_IE_GROUP_TERMINATION) {
+		it->end = it->pos;
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+tsch_ie_find(const uint8_t *buf, uint16_t len, uint8_t level,
+		uint8_t id, struct tsch_ie *ie)
+{
+	struct tsch_ie_iterator it;
+	tsch_ie_iterator_init(&it, buf, len, level);
+	while(tsch_ie_next(&it, ie)) {
+		if(ie->id == id) {
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2014, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         IEEE 802.15.4e Information Elements: in-place iteration over the
+ *         header IEs, payload IEs and MLME sub-IEs of a frame, and
+ *         builders that write IEs straight into a frame buffer. Nothing
+ *         is copied: parsed IEs point into the frame. The builders are
+ *         inline, for the ACK interrupt path.
+ */
+
+#ifndef __TSCH_IE_H__
+#define __TSCH_IE_H__
+
+#include "contiki-conf.h"
+#include "tsch-parameters.h"
+
+/* Header IE element IDs */
+#define TSCH_IE_ACK_NACK_TIME_CORRECTION 0x1e
+#define TSCH_IE_HEADER_TERMINATION_1 0x7e
+#define TSCH_IE_HEADER_TERMINATION_2 0x7f
+/* Payload IE group IDs */
+#define TSCH_IE_GROUP_MLME 0x1
+#define TSCH_IE_GROUP_VENDOR 0x2 /* content: OUI, then vendor defined */
+#define TSCH_IE_GROUP_TERMINATION 0xf
+/* MLME sub-IE IDs. Long sub-IEs are told apart with TSCH_IE_LONG */
+#define TSCH_IE_LONG 0x80
+#define TSCH_IE_SYNC 0x1a
+#define TSCH_IE_SLOTFRAME_AND_LINK 0x1b
+#define TSCH_IE_TIMESLOT 0x1c
+#define TSCH_IE_CHANNEL_HOPPING (TSCH_IE_LONG | 0x09)
+
+/* Size of an IE descriptor, and of the IE contents we use */
+#define TSCH_IE_DESCRIPTOR_LEN 2
+#define TSCH_IE_TIME_CORRECTION_LEN 2
+#define TSCH_IE_SYNC_LEN 6
+#define TSCH_IE_VENDOR_OUI_LEN 3
+
+/* Which kind of IE list an iterator walks */
+enum tsch_ie_level {
+	TSCH_IE_HEADER = 0, TSCH_IE_PAYLOAD = 1, TSCH_IE_SUB = 2,
+};
+
+/* An IE found in a frame. content points into the frame */
+struct tsch_ie {
+	uint8_t id;	/* element ID, group ID for payload IEs */
+	uint16_t len;
+	const uint8_t *content;
+};
+
+struct tsch_ie_iterator {
+	const uint8_t *pos;
+	const uint8_t *end;
+	uint8_t level;
+};
+
+/* Starts iterating over the IE list of the given level in buf */
+void tsch_ie_iterator_init(struct tsch_ie_iterator *it,
+		const uint8_t *buf, uint16_t len, uint8_t level);
+/* Fills in ie with the next IE. Returns 0 at the end of the list or on a
+ * truncated IE. A header termination IE is returned like any other IE:
+ * it->pos then points to the payload IEs */
+int tsch_ie_next(struct tsch_ie_iterator *it, struct tsch_ie *ie);
+/* Looks for IE id in the list of the given level. Returns 0 if absent */
+int tsch_ie_find(const uint8_t *buf, uint16_t len, uint8_t level,
+		uint8_t id, struct tsch_ie *ie);
+
+/* Writes a header IE descriptor, returns where the content goes */
+static inline uint8_t *
+tsch_ie_put_header(uint8_t *buf, uint8_t id, uint8_t len)
+{
+	buf[0] = (len & 0x7f) | ((id & 0x01) << 7);
+	buf[1] = id >> 1;
+	return buf + TSCH_IE_DESCRIPTOR_LEN;
+}
+
+/* Writes a payload IE descriptor, returns where the content goes */
+static inline uint8_t *
+tsch_ie_put_payload(uint8_t *buf, uint8_t group, uint16_t len)
+{
+	buf[0] = len & 0xff;
+	buf[1] = 0x80 | ((group & 0x0f) << 3) | ((len >> 8) & 0x07);
+	return buf + TSCH_IE_DESCRIPTOR_LEN;
+}
+
+/* Writes an MLME sub-IE descriptor, short or long as told by id */
+static inline uint8_t *
+tsch_ie_put_sub(uint8_t *buf, uint8_t id, uint16_t len)
+{
+	if(id & TSCH_IE_LONG) {
+		buf[0] = len & 0xff;
+		buf[1] = 0x80 | ((id & 0x0f) << 3) | ((len >> 8) & 0x07);
+	} else {
+		buf[0] = len & 0xff;
+		buf[1] = id & 0x7f;
+	}
+	return buf + TSCH_IE_DESCRIPTOR_LEN;
+}
+
+/* Writes the ACK/NACK time correction header IE: a correction in
+ * microseconds within +-2047, and the NACK flag */
+static inline uint8_t *
+tsch_ie_put_time_correction(uint8_t *buf, int16_t us, uint8_t nack)
+{
+	uint16_t status;
+	if(us >= 0) {
+		status = us & 0x07ff;
+	} else {
+		status = ((-us) & 0x07ff) | 0x0800;
+	}
+	if(nack) {
+		status |= NACK_FLAG;
+	}
+	buf = tsch_ie_put_header(buf, TSCH_IE_ACK_NACK_TIME_CORRECTION, TSCH_IE_TIME_CORRECTION_LEN);
+	buf[0] = status & 0xff;
+	buf[1] = status >> 8;
+	return buf + TSCH_IE_TIME_CORRECTION_LEN;
+}
+
+/* Reads the content of an ACK/NACK time correction IE */
+static inline void
+tsch_ie_get_time_correction(const struct tsch_ie *ie, int16_t *us, uint8_t *nack)
+{
+	uint16_t status = ie->content[0] | (ie->content[1] << 8);
+	*us = (status & 0x0800) ? -(int16_t)(status & 0x07ff) : (int16_t)(status & 0x07ff);
+	*nack = (status & NACK_FLAG) != 0;
+}
+
+/* Writes the content of a sync sub-IE: 5-byte ASN and join priority.
+ * Used to fill in an EB just before it is sent */
+static inline void
+tsch_ie_set_sync(uint8_t *content, asn_t asn, uint8_t join_priority)
+{
+	content[0] = asn;
+	content[1] = asn >> 8;
+	content[2] = asn >> 16;
+	content[3] = asn >> 24;
+	content[4] = 0;
+	content[5] = join_priority;
+}
+
+/* Reads the content of a sync sub-IE */
+static inline void
+tsch_ie_get_sync(const struct tsch_ie *ie, asn_t *asn, uint8_t *join_priority)
+{
+	*asn = (asn_t)ie->content[0] | ((asn_t)ie->content[1] << 8)
+			| ((asn_t)ie->content[2] << 16) | ((asn_t)ie->content[3] << 24);
+	*join_priority = ie->content[5];
+}
+
+#endif /* __TSCH_IE_H__ */
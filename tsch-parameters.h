@@ -14,6 +14,7 @@ typedef struct {
 	uint8_t is_sync;             // TRUE iff mote synchronized to network
 	uint8_t mac_ebsn;						//EB sequence number
 	uint8_t join_priority;			//inherit from RPL - for PAN coordinator: 0 -- lower is better
+	uint8_t is_coordinator;			//TRUE iff PAN coordinator (DODAG root)
 //   OpenQueueEntry_t*  dataToSend;         // pointer to the data to send
 //   OpenQueueEntry_t*  dataReceived;       // pointer to the data received
 //   OpenQueueEntry_t*  ackToSend;          // pointer to the ack to send
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2014, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         TSCH radio interface: the radio services TSCH needs beyond
+ *         struct radio_driver. These are soft ACKs made in the RX
+ *         interrupt, SFD timestamps of frames and ACKs, channel
+ *         selection and RSSI/LQI. A radio driver exports one
+ *         struct tsch_radio_driver, selected with TSCH_CONF_RADIO.
+ */
+
+#ifndef __TSCH_RADIO_H__
+#define __TSCH_RADIO_H__
+
+#include "contiki-conf.h"
+#include "sys/rtimer.h"
+#include "tsch-parameters.h"
+
+/* ACK: FCF 2B + SEQNO 1B, followed by the time correction IE */
+#define ACK_LEN 3
+#define EXTRA_ACK_LEN 4
+/* Frame check sequence appended by the radio */
+#define TSCH_FCS_LEN 2
+
+/* A frame received by the radio, as passed to the interrupt exit callback */
+struct received_frame_s {
+	struct received_frame_s *next;
+	uint8_t buf[TSCH_MAX_PACKET_LEN];
+	uint8_t len;
+	rimeaddr_t source_address;
+	rtimer_clock_t timestamp; /* SFD capture of the frame */
+	int8_t rssi; /* of this frame, in the unit of get_last_rssi() */
+};
+
+/* Called from the RX interrupt to make the ACK of a frame: *ackbuf is
+ * set to the ACK, whose first byte is its length */
+typedef void(softack_make_callback_f)(uint8_t **ackbuf, uint8_t seqno, rtimer_clock_t last_packet_timestamp, uint8_t nack);
+/* Called at the end of the RX interrupt. need_ack: 0 none, 1 ACK, 2 NACK */
+typedef void(softack_interrupt_exit_callback_f)(uint8_t is_ack, uint8_t need_ack, struct received_frame_s * last_rf);
+/* Called with a frame still in the driver's RX buffer. Returns 1 if it
+ * consumed the frame, which is then not passed to NETSTACK_RDC.input() */
+typedef int(rx_frame_callback_f)(const uint8_t *buf, uint8_t len, rtimer_clock_t timestamp, int8_t rssi);
+
+struct tsch_radio_driver {
+	char *name;
+	/* Subscribe with the callbacks called from the RX interrupt */
+	void (* softack_subscribe)(softack_make_callback_f *softack_make,
+			softack_interrupt_exit_callback_f *interrupt_exit);
+	void (* rx_subscribe)(rx_frame_callback_f *rx_frame);
+	/* Falling SFD edge of the last received frame, 0 while none */
+	rtimer_clock_t (* get_rx_end_time)(void);
+	/* Gives up a frame whose end was not seen in time, and frees the radio for the next one */
+	void (* rx_abort)(void);
+	/* SFD edges of the last transmission */
+	rtimer_clock_t (* get_tx_start_time)(void);
+	rtimer_clock_t (* get_tx_end_time)(void);
+	/* Sends the ACK made by the softack_make callback */
+	void (* send_ack)(void);
+	/* Reads a received ACK into buf, returns its length */
+	int (* read_ack)(void *buf, int len);
+	/* Non-zero if a frame is waiting in the radio */
+	int (* pending_irq)(void);
+	void (* address_decode)(uint8_t enable);
+	/* Selects the SFD edges to capture, and aligns the capture timer with rtimer */
+	void (* sfd_sync)(uint8_t capture_start_sfd, uint8_t capture_end_sfd);
+	/* Time of the last captured SFD edge */
+	uint16_t (* read_sfd_timer)(void);
+	int (* set_channel)(int channel);
+	/* RSSI (raw register value) and LQI of the last frame or ACK received */
+	int8_t (* get_last_rssi)(void);
+	uint8_t (* get_last_correlation)(void);
+};
+
+#ifdef TSCH_CONF_RADIO
+#define TSCH_RADIO TSCH_CONF_RADIO
+#else
+#define TSCH_RADIO cc2420_tsch_radio
+#endif /* TSCH_CONF_RADIO */
+
+extern const struct tsch_radio_driver TSCH_RADIO;
+
+#endif /* __TSCH_RADIO_H__ */
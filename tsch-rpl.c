@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2014, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         Glue between TSCH and RPL: feeds the per-neighbor ETX
+ *         estimated by TSCH into the RPL parent link metrics, keeps
+ *         the RPL preferred parent as the TSCH time source, and derives
+ *         the join priority advertised in EBs from the RPL rank.
+ */
+
+#include "contiki.h"
+#include "tsch.h"
+#include "tsch-rpl.h"
+
+#if UIP_CONF_IPV6_RPL
+
+#include "net/rpl/rpl-private.h"
+#include "net/nbr-table.h"
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+/* Period at which the time source and the join priority are refreshed */
+#ifdef TSCH_RPL_CONF_UPDATE_INTERVAL
+#define TSCH_RPL_UPDATE_INTERVAL TSCH_RPL_CONF_UPDATE_INTERVAL
+#else
+#define TSCH_RPL_UPDATE_INTERVAL (10 * CLOCK_SECOND)
+#endif /* TSCH_RPL_CONF_UPDATE_INTERVAL */
+
+PROCESS(tsch_rpl_process, "tsch_rpl_process");
+
+/* the stock MRHOF, which does everything but the link estimation */
+extern rpl_of_t rpl_of_etx;
+
+/* the preferred parent we last made our time source */
+static rimeaddr_t time_source;
+/*---------------------------------------------------------------------------*/
+/* MRHOF with the MAC-level ETX as link metric. RPL calls the link callback
+ * after every unicast to a parent; instead of running its own estimator on
+ * the sent status, it takes the ETX TSCH keeps from the ACK outcomes, so the
+ * metric has a single source. Select it with RPL_CONF_OF tsch_rpl_of. */
+static void
+neighbor_link_callback(rpl_parent_t *p, int status, int numtx)
+{
+	uint16_t etx = tsch_get_link_etx((rimeaddr_t *)nbr_table_get_lladdr(rpl_parents, p));
+	if(etx != 0) {
+		uint16_t metric = (uint32_t)etx * RPL_DAG_MC_ETX_DIVISOR / TSCH_ETX_DIVISOR;
+		if(metric != p->link_metric) {
+			PRINTF("tsch-rpl: link metric %u -> %u\n", p->link_metric, metric);
+			p->link_metric = metric;
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+reset(rpl_dag_t *dag)
+{
+	rpl_of_etx.reset(dag);
+}
+/*---------------------------------------------------------------------------*/
+static rpl_parent_t *
+best_parent(rpl_parent_t *p1, rpl_parent_t *p2)
+{
+	return rpl_of_etx.best_parent(p1, p2);
+}
+/*---------------------------------------------------------------------------*/
+static rpl_dag_t *
+best_dag(rpl_dag_t *d1, rpl_dag_t *d2)
+{
+	return rpl_of_etx.best_dag(d1, d2);
+}
+/*---------------------------------------------------------------------------*/
+static rpl_rank_t
+calculate_rank(rpl_parent_t *p, rpl_rank_t base_rank)
+{
+	return rpl_of_etx.calculate_rank(p, base_rank);
+}
+/*---------------------------------------------------------------------------*/
+static void
+update_metric_container(rpl_instance_t *instance)
+{
+	rpl_of_etx.update_metric_container(instance);
+}
+/*---------------------------------------------------------------------------*/
+rpl_of_t tsch_rpl_of = {
+	reset,
+	neighbor_link_callback,
+	best_parent,
+	best_dag,
+	calculate_rank,
+	update_metric_container,
+	RPL_OCP_MRHOF
+};
+/*---------------------------------------------------------------------------*/
+/* Follows the RPL preferred parent with the TSCH time source. The root has
+ * no preferred parent and keeps the time sources of its schedule. */
+static void
+update_time_source(void)
+{
+	rpl_dag_t *dag = rpl_get_any_dag();
+	rimeaddr_t *addr;
+
+	if(dag == NULL || dag->preferred_parent == NULL) {
+		return;
+	}
+	addr = (rimeaddr_t *)nbr_table_get_lladdr(rpl_parents, dag->preferred_parent);
+	if(addr != NULL && !rimeaddr_cmp(addr, &time_source)) {
+		PRINTF("tsch-rpl: new time source %02x%02x\n",
+				addr->u8[RIMEADDR_SIZE - 2], addr->u8[RIMEADDR_SIZE - 1]);
+		tsch_set_time_source(addr);
+		rimeaddr_copy(&time_source, addr);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* Advertises DAG_RANK(rank) - 1 as join priority: 0 at the root, and one
+ * more per hop. Without a DAG we are not a good node to join through. */
+static void
+update_join_priority(void)
+{
+	rpl_dag_t *dag = rpl_get_any_dag();
+	uint16_t join_priority = 0xff;
+
+	if(dag != NULL && dag->instance != NULL && dag->rank != INFINITE_RANK) {
+		join_priority = DAG_RANK(dag->rank, dag->instance) - 1;
+		if(join_priority > 0xfe) {
+			join_priority = 0xfe;
+		}
+	}
+	tsch_set_join_priority(join_priority);
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(tsch_rpl_process, ev, data)
+{
+	static struct etimer et;
+	PROCESS_BEGIN();
+	etimer_set(&et, TSCH_RPL_UPDATE_INTERVAL);
+	while(1) {
+		PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+		etimer_reset(&et);
+		update_time_source();
+		update_join_priority();
+	}
+	PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_rpl_init(void)
+{
+	process_start(&tsch_rpl_process, NULL);
+}
+/*---------------------------------------------------------------------------*/
+#else /* UIP_CONF_IPV6_RPL */
+void
+tsch_rpl_init(void)
+{
+}
+#endif /* UIP_CONF_IPV6_RPL */
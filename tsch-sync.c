@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2014, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         TSCH time synchronization: combines the offsets measured
+ *         from all time-source neighbors into one clock correction.
+ *
+ *         Every time source keeps the average of the offsets measured
+ *         during the current slotframe and its last known offset. At the
+ *         slotframe boundary, sources that disagree with the median by
+ *         more than TSCH_SYNC_OUTLIER_THRESHOLD are discarded and the rest
+ *         are averaged, weighted by sample age and link ETX. The applied
+ *         correction is then subtracted from all stored offsets, so that an
+ *         old sample is never applied twice.
+ */
+
+#include "contiki.h"
+#include "tsch.h"
+#include "tsch-sync.h"
+#include <string.h>
+#if TSCH_SYNC_WITH_TELEMETRY
+#include <stdio.h>
+#endif /* TSCH_SYNC_WITH_TELEMETRY */
+
+/* Number of time sources tracked */
+#ifdef TSCH_SYNC_CONF_MAX_SOURCES
+#define TSCH_SYNC_MAX_SOURCES TSCH_SYNC_CONF_MAX_SOURCES
+#else
+#define TSCH_SYNC_MAX_SOURCES 4
+#endif /* TSCH_SYNC_CONF_MAX_SOURCES */
+
+/* Age in slots after which a sample is ignored */
+#ifdef TSCH_SYNC_CONF_MAX_AGE
+#define TSCH_SYNC_MAX_AGE TSCH_SYNC_CONF_MAX_AGE
+#else
+#define TSCH_SYNC_MAX_AGE 512
+#endif /* TSCH_SYNC_CONF_MAX_AGE */
+
+/* Distance in ticks from the median beyond which a source is an outlier */
+#ifdef TSCH_SYNC_CONF_OUTLIER_THRESHOLD
+#define TSCH_SYNC_OUTLIER_THRESHOLD TSCH_SYNC_CONF_OUTLIER_THRESHOLD
+#else
+#define TSCH_SYNC_OUTLIER_THRESHOLD 8
+#endif /* TSCH_SYNC_CONF_OUTLIER_THRESHOLD */
+#define OUTLIER_THRESHOLD ((int16_t)TSCH_SYNC_OUTLIER_THRESHOLD << TSCH_SYNC_SUBTICK_BITS)
+
+struct tsch_sync_source {
+	rimeaddr_t addr;
+	asn_t asn; /* time of the last sample */
+	int32_t sum; /* sum of the samples of this slotframe */
+	int16_t offset; /* last offset, relative to our current clock */
+	uint16_t etx;
+	uint8_t count; /* number of samples in sum */
+	uint8_t valid;
+#if TSCH_SYNC_WITH_TELEMETRY
+	uint8_t fresh; /* measured in the slotframe that just ended */
+	/* offsets against our free-running clock, for the skew */
+	int32_t first_raw_offset, last_raw_offset;
+	asn_t first_asn;
+	/* for the mean and variance of the measured offsets */
+	uint16_t samples;
+	int32_t offset_sum;
+	uint32_t offset_square_sum;
+#endif /* TSCH_SYNC_WITH_TELEMETRY */
+};
+
+static struct tsch_sync_source sources[TSCH_SYNC_MAX_SOURCES];
+/* part of the previous corrections smaller than a tick, in sub-ticks */
+static int16_t residue;
+/* drift of our clock learnt from the corrections, in sub-ticks per 1024 slots */
+static int32_t drift_rate;
+static asn_t last_correction_asn;
+#if TSCH_SYNC_WITH_TELEMETRY
+/* sum of all corrections, in sub-ticks */
+static int32_t total_correction;
+static struct tsch_sync_log_entry sync_log[TSCH_SYNC_LOG_SIZE];
+static uint8_t sync_log_ptr, sync_log_count;
+/*---------------------------------------------------------------------------*/
+/* accounts the offset s measured in the slotframe that just ended */
+static void
+telemetry_add_offset(struct tsch_sync_source *s)
+{
+	int32_t raw = s->offset + total_correction;
+	uint32_t square = (int32_t)s->offset * s->offset;
+	if(s->samples == 0) {
+		s->first_raw_offset = raw;
+		s->first_asn = s->asn;
+	}
+	s->last_raw_offset = raw;
+	/* stop accumulating rather than overflow */
+	if(s->samples < 0xffff && s->offset_square_sum <= 0xffffffffUL - square) {
+		s->samples++;
+		s->offset_sum += s->offset;
+		s->offset_square_sum += square;
+	}
+	s->fresh = 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+telemetry_log(struct tsch_sync_source *s, asn_t asn, int16_t correction)
+{
+	struct tsch_sync_log_entry *e = &sync_log[sync_log_ptr];
+	e->asn = asn;
+	e->source = (s->addr.u8[RIMEADDR_SIZE - 2] << 8) | s->addr.u8[RIMEADDR_SIZE - 1];
+	e->offset = s->offset;
+	e->correction = correction;
+	e->residual = s->offset - correction;
+	sync_log_ptr = (sync_log_ptr + 1) & (TSCH_SYNC_LOG_SIZE - 1);
+	if(sync_log_count < TSCH_SYNC_LOG_SIZE) {
+		sync_log_count++;
+	}
+	s->fresh = 0;
+}
+#endif /* TSCH_SYNC_WITH_TELEMETRY */
+/*---------------------------------------------------------------------------*/
+static struct tsch_sync_source *
+find_source(const rimeaddr_t *addr)
+{
+	uint8_t i;
+	for(i = 0; i < TSCH_SYNC_MAX_SOURCES; i++) {
+		if(sources[i].valid && rimeaddr_cmp(&sources[i].addr, addr)) {
+			return &sources[i];
+		}
+	}
+	return NULL;
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_sync_init(void)
+{
+	memset(sources, 0, sizeof(sources));
+	residue = 0;
+	drift_rate = 0;
+	last_correction_asn = 0;
+#if TSCH_SYNC_WITH_TELEMETRY
+	total_correction = 0;
+	sync_log_ptr = sync_log_count = 0;
+#endif /* TSCH_SYNC_WITH_TELEMETRY */
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_sync_add_sample(const rimeaddr_t *addr, int16_t offset, uint16_t etx, asn_t asn)
+{
+	struct tsch_sync_source *s = find_source(addr);
+	uint8_t i;
+
+	if(s == NULL) {
+		/* take a free entry, or the one that has not been heard for the longest */
+		s = &sources[0];
+		for(i = 0; i < TSCH_SYNC_MAX_SOURCES; i++) {
+			if(!sources[i].valid) {
+				s = &sources[i];
+				break;
+			}
+			if((int32_t)(sources[i].asn - s->asn) < 0) {
+				s = &sources[i];
+			}
+		}
+		memset(s, 0, sizeof(*s));
+		rimeaddr_copy(&s->addr, addr);
+		s->valid = 1;
+	}
+	if(s->count < 0xff) {
+		s->sum += offset;
+		s->count++;
+	}
+	s->etx = etx;
+	s->asn = asn;
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_sync_remove_source(const rimeaddr_t *addr)
+{
+	struct tsch_sync_source *s = find_source(addr);
+	if(s != NULL) {
+		s->valid = 0;
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* weight of a source from 0 to 64: up to 16 for the age, times up to 4 for the link */
+static uint16_t
+source_weight(const struct tsch_sync_source *s, asn_t asn)
+{
+	asn_t age = asn - s->asn;
+	uint16_t w_age, w_link;
+
+	if(age >= TSCH_SYNC_MAX_AGE) {
+		return 0;
+	}
+	w_age = 1 + (uint32_t)(TSCH_SYNC_MAX_AGE - age) * 15 / TSCH_SYNC_MAX_AGE;
+	if(s->etx == 0) {
+		w_link = 2;
+	} else {
+		w_link = (4 * TSCH_ETX_DIVISOR) / s->etx;
+		w_link = w_link < 1 ? 1 : (w_link > 4 ? 4 : w_link);
+	}
+	return w_age * w_link;
+}
+/*---------------------------------------------------------------------------*/
+/* a correction spread over the slots since the previous one is our drift */
+static void
+update_drift_rate(int16_t correction, asn_t asn)
+{
+	asn_t elapsed = asn - last_correction_asn;
+	last_correction_asn = asn;
+	if(elapsed == 0 || elapsed > TSCH_SYNC_MAX_AGE) {
+		/* first correction, or a gap: not a drift measurement */
+		return;
+	}
+	drift_rate += ((int32_t)correction * 1024 / (int32_t)elapsed - drift_rate) / 8;
+}
+/*---------------------------------------------------------------------------*/
+int16_t
+tsch_sync_correction(asn_t asn)
+{
+	int16_t offsets[TSCH_SYNC_MAX_SOURCES];
+	int16_t median, correction = 0;
+	int32_t weighted_sum = 0;
+	uint16_t total_weight = 0;
+	uint8_t i, j, n = 0, fresh = 0;
+
+	/* fold this slotframe's samples into the per-source offsets */
+	for(i = 0; i < TSCH_SYNC_MAX_SOURCES; i++) {
+		struct tsch_sync_source *s = &sources[i];
+		if(!s->valid) {
+			continue;
+		}
+		if(s->count) {
+			s->offset = s->sum / s->count;
+			s->sum = 0;
+			s->count = 0;
+			fresh++;
+#if TSCH_SYNC_WITH_TELEMETRY
+			telemetry_add_offset(s);
+#endif /* TSCH_SYNC_WITH_TELEMETRY */
+		}
+		if(source_weight(s, asn) == 0) {
+			/* too old to be trusted */
+			s->valid = 0;
+			continue;
+		}
+		/* insertion sort, to find the median */
+		for(j = n; j > 0 && offsets[j - 1] > s->offset; j--) {
+			offsets[j] = offsets[j - 1];
+		}
+		offsets[j] = s->offset;
+		n++;
+	}
+	/* nothing new since the last correction */
+	if(!fresh || !n) {
+		return 0;
+	}
+	median = offsets[n / 2];
+
+	for(i = 0; i < TSCH_SYNC_MAX_SOURCES; i++) {
+		struct tsch_sync_source *s = &sources[i];
+		uint16_t w;
+		if(!s->valid) {
+			continue;
+		}
+		/* with two sources or less there is no majority to tell who is wrong */
+		if(n > 2 && (s->offset - median > OUTLIER_THRESHOLD
+				|| median - s->offset > OUTLIER_THRESHOLD)) {
+			continue;
+		}
+		w = source_weight(s, asn);
+		weighted_sum += (int32_t)w * s->offset;
+		total_weight += w;
+	}
+	if(total_weight) {
+		correction = weighted_sum / total_weight;
+	}
+
+	/* stored offsets assume the whole correction gets applied... */
+	for(i = 0; i < TSCH_SYNC_MAX_SOURCES; i++) {
+		if(sources[i].valid) {
+#if TSCH_SYNC_WITH_TELEMETRY
+			if(sources[i].fresh) {
+				telemetry_log(&sources[i], asn, correction);
+			}
+#endif /* TSCH_SYNC_WITH_TELEMETRY */
+			sources[i].offset -= correction;
+		}
+	}
+#if TSCH_SYNC_WITH_TELEMETRY
+	total_correction += correction;
+#endif /* TSCH_SYNC_WITH_TELEMETRY */
+	update_drift_rate(correction, asn);
+	/* ...but the clock only moves by whole ticks: keep the rest for later */
+	correction += residue;
+	residue = correction % (1 << TSCH_SYNC_SUBTICK_BITS);
+	return correction / (1 << TSCH_SYNC_SUBTICK_BITS);
+}
+/*---------------------------------------------------------------------------*/
+int16_t
+tsch_sync_predict(asn_t asn)
+{
+	int32_t correction = drift_rate * (int32_t)(asn - last_correction_asn) / 1024;
+	last_correction_asn = asn;
+	correction += residue;
+	residue = correction % (1 << TSCH_SYNC_SUBTICK_BITS);
+	return correction / (1 << TSCH_SYNC_SUBTICK_BITS);
+}
+/*---------------------------------------------------------------------------*/
+#if TSCH_SYNC_WITH_TELEMETRY
+int
+tsch_sync_get_stats(const rimeaddr_t *addr, struct tsch_sync_stats *stats)
+{
+	struct tsch_sync_source *s = find_source(addr);
+	int32_t mean, variance;
+	asn_t elapsed;
+
+	if(s == NULL || s->samples == 0) {
+		return 0;
+	}
+	stats->samples = s->samples;
+	mean = s->offset_sum / s->samples;
+	stats->mean_offset = mean;
+	variance = (int32_t)(s->offset_square_sum / s->samples) - mean * mean;
+	stats->offset_variance = variance > 0 ? variance : 0;
+	/* skew = offset drift over the elapsed time, both in ticks */
+	elapsed = s->asn - s->first_asn;
+	if(elapsed) {
+		stats->skew_ppb = (int64_t)(s->last_raw_offset - s->first_raw_offset) * 1000000000LL
+				/ ((int64_t)elapsed * TsSlotDuration << TSCH_SYNC_SUBTICK_BITS);
+	} else {
+		stats->skew_ppb = 0;
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+const struct tsch_sync_log_entry *
+tsch_sync_get_log(uint8_t i)
+{
+	if(i >= sync_log_count) {
+		return NULL;
+	}
+	return &sync_log[(sync_log_ptr - 1 - i) & (TSCH_SYNC_LOG_SIZE - 1)];
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_sync_print(void)
+{
+	struct tsch_sync_stats stats;
+	const struct tsch_sync_log_entry *e;
+	uint8_t i;
+
+	for(i = 0; i < TSCH_SYNC_MAX_SOURCES; i++) {
+		if(sources[i].valid && tsch_sync_get_stats(&sources[i].addr, &stats)) {
+			printf("tsch sync %02x%02x samples %u mean %d var %lu skew_ppb %ld\n",
+					sources[i].addr.u8[RIMEADDR_SIZE - 2], sources[i].addr.u8[RIMEADDR_SIZE - 1],
+					stats.samples, stats.mean_offset, (unsigned long)stats.offset_variance,
+					(long)stats.skew_ppb);
+		}
+	}
+	for(i = sync_log_count; i > 0; i--) {
+		e = tsch_sync_get_log(i - 1);
+		printf("tsch sync log asn %lu src %04x offset %d correction %d residual %d\n",
+				(unsigned long)e->asn, e->source, e->offset, e->correction, e->residual);
+	}
+}
+#endif /* TSCH_SYNC_WITH_TELEMETRY */
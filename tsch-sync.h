@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2014, Swedish Institute of Computer Science.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file is part of the Contiki operating system.
+ *
+ */
+
+/**
+ * \file
+ *         TSCH time synchronization: combines the offsets measured
+ *         from all time-source neighbors into one clock correction.
+ */
+
+#ifndef __TSCH_SYNC_H__
+#define __TSCH_SYNC_H__
+
+#include "contiki-conf.h"
+#include "tsch-parameters.h"
+
+/* Offsets are given in 1/2^TSCH_SYNC_SUBTICK_BITS rtimer ticks, so that the
+ * sub-tick part of microsecond measurements is not lost */
+#define TSCH_SYNC_SUBTICK_BITS 4
+
+/* Keeps a log of the applied corrections and per-source offset statistics */
+#ifdef TSCH_SYNC_CONF_WITH_TELEMETRY
+#define TSCH_SYNC_WITH_TELEMETRY TSCH_SYNC_CONF_WITH_TELEMETRY
+#else
+#define TSCH_SYNC_WITH_TELEMETRY 0
+#endif /* TSCH_SYNC_CONF_WITH_TELEMETRY */
+
+/* Number of entries in the correction log. Should be a power of two */
+#ifdef TSCH_SYNC_CONF_LOG_SIZE
+#define TSCH_SYNC_LOG_SIZE TSCH_SYNC_CONF_LOG_SIZE
+#else
+#define TSCH_SYNC_LOG_SIZE 16
+#endif /* TSCH_SYNC_CONF_LOG_SIZE */
+
+/* One time source's part in a correction. Offsets are in sub-ticks */
+struct tsch_sync_log_entry {
+	asn_t asn;
+	uint16_t source;	/* last two bytes of the time source address */
+	int16_t offset;	/* offset measured during the slotframe */
+	int16_t correction;	/* correction computed from all time sources */
+	int16_t residual;	/* offset - correction */
+};
+
+/* Statistics of the offsets measured from one time source */
+struct tsch_sync_stats {
+	uint16_t samples;	/* slotframes with a measurement */
+	int16_t mean_offset;	/* in sub-ticks */
+	uint32_t offset_variance;	/* in sub-ticks^2 */
+	int32_t skew_ppb;	/* clock skew against our oscillator, in parts per billion */
+};
+
+/* Forgets all samples */
+void tsch_sync_init(void);
+/* Records an offset measured from time source addr: the number of sub-ticks
+ * our slotframe must be stretched by to align with it (negative: shortened).
+ * etx is the link ETX (TSCH_ETX_DIVISOR units, 0 if unknown) */
+void tsch_sync_add_sample(const rimeaddr_t *addr, int16_t offset, uint16_t etx, asn_t asn);
+/* Returns the correction in whole ticks to apply at this slotframe boundary,
+ * and accounts for it in the stored samples. The sub-tick remainder is
+ * carried over to the next correction */
+int16_t tsch_sync_correction(asn_t asn);
+/* Returns the correction in whole ticks for this slotframe boundary predicted
+ * from the drift learnt so far, for when no time source can be heard. Samples
+ * are kept */
+int16_t tsch_sync_predict(asn_t asn);
+/* Forgets the samples of a neighbor that is no longer a time source */
+void tsch_sync_remove_source(const rimeaddr_t *addr);
+
+#if TSCH_SYNC_WITH_TELEMETRY
+/* Fills in the statistics of time source addr. Returns 0 if unknown */
+int tsch_sync_get_stats(const rimeaddr_t *addr, struct tsch_sync_stats *stats);
+/* Returns the i-th most recent log entry, NULL if there is none */
+const struct tsch_sync_log_entry *tsch_sync_get_log(uint8_t i);
+/* Prints the statistics and the log on the serial line */
+void tsch_sync_print(void);
+#endif /* TSCH_SYNC_WITH_TELEMETRY */
+
+#endif /* __TSCH_SYNC_H__ */
@@ -39,23 +39,30 @@
 #include "contiki.h"
 #include "contiki-conf.h"
 #include "tsch.h"
+#include "tsch-rpl.h"
+#include "tsch-sync.h"
+#include "tsch-conversion.h"
+#include "tsch-ie.h"
 #include "net/packetbuf.h"
 #include "net/queuebuf.h"
 #include "net/netstack.h"
 #include "net/rime/rimestats.h"
+#include "net/mac/frame802154.h"
 #include <string.h>
 #include "sys/rtimer.h"
 #include "cooja-debug.h"
 #include "lib/list.h"
 #include "lib/memb.h"
 #include "lib/random.h"
-#include "dev/cc2420-tsch.h"
+#include "tsch-radio.h"
 
 static volatile ieee154e_vars_t ieee154e_vars;
 
 #define DEBUG 0
-#if DEBUG
+#if DEBUG || TSCH_CONF_WITH_STATS
 #include <stdio.h>
+#endif
+#if DEBUG
 #define PRINTF(...) printf(__VA_ARGS__)
 #else
 #define PRINTF(...)
@@ -67,6 +74,221 @@ static volatile ieee154e_vars_t ieee154e_vars;
 #define TSCH_ADDRESS_FILTER 0
 #endif /* TSCH_CONF_ADDRESS_FILTER */
 
+/* Link-layer aggregation: pack several small packets queued for the same
+ * neighbor into a single frame. Must be enabled on both ends of a link. */
+#ifdef TSCH_CONF_WITH_AGGREGATION
+#define TSCH_WITH_AGGREGATION TSCH_CONF_WITH_AGGREGATION
+#else
+#define TSCH_WITH_AGGREGATION 0
+#endif /* TSCH_CONF_WITH_AGGREGATION */
+
+#if TSCH_WITH_AGGREGATION
+/* First payload byte of an aggregated frame. Unused by 6LoWPAN (RFC 4944 reserved range) */
+#ifdef TSCH_CONF_AGGREGATION_DISPATCH
+#define TSCH_AGGREGATION_DISPATCH TSCH_CONF_AGGREGATION_DISPATCH
+#else
+#define TSCH_AGGREGATION_DISPATCH 0xf0
+#endif /* TSCH_CONF_AGGREGATION_DISPATCH */
+
+/* Max number of packets packed in one frame */
+#ifdef TSCH_CONF_MAX_AGGREGATED
+#define TSCH_MAX_AGGREGATED TSCH_CONF_MAX_AGGREGATED
+#else
+#define TSCH_MAX_AGGREGATED 4
+#endif /* TSCH_CONF_MAX_AGGREGATED */
+#endif /* TSCH_WITH_AGGREGATION */
+
+/* Lifetime of a queued packet in slots, 0 for none.
+ * Expired packets are failed back to the upper layer with MAC_TX_ERR */
+#ifdef TSCH_CONF_PACKET_TTL
+#define TSCH_PACKET_TTL TSCH_CONF_PACKET_TTL
+#else
+#define TSCH_PACKET_TTL 0
+#endif /* TSCH_CONF_PACKET_TTL */
+
+/* Per-neighbor histograms of queueing delay, transmissions and final status */
+#ifdef TSCH_CONF_WITH_STATS
+#define TSCH_WITH_STATS TSCH_CONF_WITH_STATS
+#else
+#define TSCH_WITH_STATS 0
+#endif /* TSCH_CONF_WITH_STATS */
+
+/* Number of pending TX status reports for the upper layer. Should be a power of two.
+ * Every queued packet holds a queuebuf, so at most QUEUEBUF_NUM packets end at once,
+ * e.g., when a neighbor is flushed: the default leaves room for twice as many, in
+ * case tsch_tx_callback_process runs late */
+#ifdef TSCH_CONF_TX_STATUS_QUEUE_SIZE
+#define TX_STATUS_QUEUE_SIZE TSCH_CONF_TX_STATUS_QUEUE_SIZE
+#else
+#define TX_STATUS_QUEUE_SIZE (2 * NBR_BUFFER_SIZE)
+#endif /* TSCH_CONF_TX_STATUS_QUEUE_SIZE */
+
+/* Adaptive channel blacklisting: the coordinator tracks the ACK success of
+ * each channel and removes the bad ones from the hopping sequence */
+#ifdef TSCH_CONF_WITH_CHANNEL_BLACKLIST
+#define TSCH_WITH_CHANNEL_BLACKLIST TSCH_CONF_WITH_CHANNEL_BLACKLIST
+#else
+#define TSCH_WITH_CHANNEL_BLACKLIST 0
+#endif /* TSCH_CONF_WITH_CHANNEL_BLACKLIST */
+
+/* ACK success EWMA (0..255) under which a channel gets blacklisted */
+#ifdef TSCH_CONF_BLACKLIST_THRESHOLD
+#define TSCH_BLACKLIST_THRESHOLD TSCH_CONF_BLACKLIST_THRESHOLD
+#else
+#define TSCH_BLACKLIST_THRESHOLD 128
+#endif /* TSCH_CONF_BLACKLIST_THRESHOLD */
+
+/* Transmissions on a channel before its quality is trusted */
+#ifdef TSCH_CONF_BLACKLIST_MIN_SAMPLES
+#define TSCH_BLACKLIST_MIN_SAMPLES TSCH_CONF_BLACKLIST_MIN_SAMPLES
+#else
+#define TSCH_BLACKLIST_MIN_SAMPLES 8
+#endif /* TSCH_CONF_BLACKLIST_MIN_SAMPLES */
+
+/* Upper bound on blacklisted channels, so that we always keep some diversity */
+#ifdef TSCH_CONF_BLACKLIST_MAX_CHANNELS
+#define TSCH_BLACKLIST_MAX_CHANNELS TSCH_CONF_BLACKLIST_MAX_CHANNELS
+#else
+#define TSCH_BLACKLIST_MAX_CHANNELS 8
+#endif /* TSCH_CONF_BLACKLIST_MAX_CHANNELS */
+
+/* Channel hopping sequence, as a brace-enclosed list of channels. Defaults to
+ * the IEEE 802.15.4e default sequence for the 2.4 GHz band */
+#ifdef TSCH_CONF_HOPPING_SEQUENCE
+#define TSCH_HOPPING_SEQUENCE TSCH_CONF_HOPPING_SEQUENCE
+#else
+#define TSCH_HOPPING_SEQUENCE { 16, 17, 23, 18, 26, 15, 25, 22, 19, 11, 12, 13, 24, 14, 20, 21 }
+#endif /* TSCH_CONF_HOPPING_SEQUENCE */
+
+/* OUI of the vendor-specific payload IE in our EBs, which carries the
+ * blacklist and non-default hopping sequences. Set it to the OUI of your
+ * organization */
+#ifdef TSCH_CONF_VENDOR_OUI
+#define TSCH_VENDOR_OUI TSCH_CONF_VENDOR_OUI
+#else
+#define TSCH_VENDOR_OUI { 0x00, 0x00, 0x00 }
+#endif /* TSCH_CONF_VENDOR_OUI */
+
+/* Slots between the decision to change the hopping function and the
+ * switch, rounded up to a slotframe boundary. EBs announce the switch ASN
+ * meanwhile, so that all nodes change at the same slot */
+#ifdef TSCH_CONF_HOPPING_SWITCH_DELAY
+#define TSCH_HOPPING_SWITCH_DELAY TSCH_CONF_HOPPING_SWITCH_DELAY
+#else
+#define TSCH_HOPPING_SWITCH_DELAY (4 * TSCH_EB_TRICKLE_IMIN)
+#endif /* TSCH_CONF_HOPPING_SWITCH_DELAY */
+
+/* Longest hopping sequence accepted by tsch_set_hopping_sequence() */
+#ifdef TSCH_CONF_HOPPING_SEQUENCE_MAX_LEN
+#define TSCH_HOPPING_SEQUENCE_MAX_LEN TSCH_CONF_HOPPING_SEQUENCE_MAX_LEN
+#else
+#define TSCH_HOPPING_SEQUENCE_MAX_LEN 16
+#endif /* TSCH_CONF_HOPPING_SEQUENCE_MAX_LEN */
+
+/* ETX sample accounted for a packet that was never acknowledged */
+#ifdef TSCH_CONF_ETX_NOACK_PENALTY
+#define TSCH_ETX_NOACK_PENALTY TSCH_CONF_ETX_NOACK_PENALTY
+#else
+#define TSCH_ETX_NOACK_PENALTY (2 * macMaxFrameRetries)
+#endif /* TSCH_CONF_ETX_NOACK_PENALTY */
+
+/* Slots during which we do not transmit to a neighbor that answered with a NACK */
+#ifdef TSCH_CONF_NACK_BACKOFF
+#define TSCH_NACK_BACKOFF TSCH_CONF_NACK_BACKOFF
+#else
+#define TSCH_NACK_BACKOFF 32
+#endif /* TSCH_CONF_NACK_BACKOFF */
+
+/* PAN ID advertised in EBs */
+#ifdef IEEE802154_CONF_PANID
+#define TSCH_PANID IEEE802154_CONF_PANID
+#else
+#define TSCH_PANID 0xABCD
+#endif /* IEEE802154_CONF_PANID */
+
+/* Association scan: the radio listens TSCH_SCAN_ON_TIME out of every
+ * TSCH_SCAN_PERIOD (clock ticks), and moves to the next channel of the
+ * hopping sequence every TSCH_SCAN_DWELL periods */
+#ifdef TSCH_CONF_SCAN_PERIOD
+#define TSCH_SCAN_PERIOD TSCH_CONF_SCAN_PERIOD
+#else
+#define TSCH_SCAN_PERIOD CLOCK_SECOND
+#endif /* TSCH_CONF_SCAN_PERIOD */
+
+#ifdef TSCH_CONF_SCAN_ON_TIME
+#define TSCH_SCAN_ON_TIME TSCH_CONF_SCAN_ON_TIME
+#else
+#define TSCH_SCAN_ON_TIME (CLOCK_SECOND / 2)
+#endif /* TSCH_CONF_SCAN_ON_TIME */
+
+/* Trickle timer of the EBs, in slots: the interval grows from
+ * TSCH_EB_TRICKLE_IMIN (a power of two) by TSCH_EB_TRICKLE_DOUBLINGS
+ * doublings, but never so long that children of ours may desynchronize
+ * (see TSCH_DESYNC_THRESHOLD), and an EB is suppressed once
+ * TSCH_EB_TRICKLE_K consistent EBs were heard in the interval */
+#ifdef TSCH_CONF_EB_TRICKLE_IMIN
+#define TSCH_EB_TRICKLE_IMIN TSCH_CONF_EB_TRICKLE_IMIN
+#else
+#define TSCH_EB_TRICKLE_IMIN 256
+#endif /* TSCH_CONF_EB_TRICKLE_IMIN */
+
+#ifdef TSCH_CONF_EB_TRICKLE_DOUBLINGS
+#define TSCH_EB_TRICKLE_DOUBLINGS TSCH_CONF_EB_TRICKLE_DOUBLINGS
+#else
+#define TSCH_EB_TRICKLE_DOUBLINGS 6
+#endif /* TSCH_CONF_EB_TRICKLE_DOUBLINGS */
+
+#ifdef TSCH_CONF_EB_TRICKLE_K
+#define TSCH_EB_TRICKLE_K TSCH_CONF_EB_TRICKLE_K
+#else
+#define TSCH_EB_TRICKLE_K 2
+#endif /* TSCH_CONF_EB_TRICKLE_K */
+
+#ifdef TSCH_CONF_DESYNC_THRESHOLD
+#define TSCH_DESYNC_THRESHOLD TSCH_CONF_DESYNC_THRESHOLD
+#else
+/* ~30s without hearing a time source */
+#define TSCH_DESYNC_THRESHOLD 2000
+#endif /* TSCH_CONF_DESYNC_THRESHOLD */
+
+/* Slots spent rejoining, i.e., listening on EB and time-source cells with
+ * widened guard times, before falling back to a full scan */
+#ifdef TSCH_CONF_REJOIN_TIMEOUT
+#define TSCH_REJOIN_TIMEOUT TSCH_CONF_REJOIN_TIMEOUT
+#else
+#define TSCH_REJOIN_TIMEOUT 1000
+#endif /* TSCH_CONF_REJOIN_TIMEOUT */
+
+/* Guard time while rejoining, in ticks. Must be less than TsTxOffset */
+#ifdef TSCH_CONF_REJOIN_GUARD
+#define TSCH_REJOIN_GUARD TSCH_CONF_REJOIN_GUARD
+#else
+#define TSCH_REJOIN_GUARD (TsTxOffset - maxRxDataPrepare)
+#endif /* TSCH_CONF_REJOIN_GUARD */
+
+/* Clock ticks we keep scanning after the first EB to find the best node
+ * to join through (lowest join priority, then strongest signal). 0 joins
+ * on the first EB. Scan periods must not exceed one second for the EB
+ * timestamps to stay valid meanwhile */
+#ifdef TSCH_CONF_JOIN_SELECT_TIME
+#define TSCH_JOIN_SELECT_TIME TSCH_CONF_JOIN_SELECT_TIME
+#else
+#define TSCH_JOIN_SELECT_TIME (2 * CLOCK_SECOND)
+#endif /* TSCH_CONF_JOIN_SELECT_TIME */
+
+#ifdef TSCH_CONF_SCAN_DWELL
+#define TSCH_SCAN_DWELL TSCH_CONF_SCAN_DWELL
+#else
+#define TSCH_SCAN_DWELL 2
+#endif /* TSCH_CONF_SCAN_DWELL */
+
+/* Slotframes after which blacklisted channels are probed again */
+#ifdef TSCH_CONF_BLACKLIST_PROBE_PERIOD
+#define TSCH_BLACKLIST_PROBE_PERIOD TSCH_CONF_BLACKLIST_PROBE_PERIOD
+#else
+#define TSCH_BLACKLIST_PROBE_PERIOD 64
+#endif /* TSCH_CONF_BLACKLIST_PROBE_PERIOD */
+
 #ifndef TSCH_802154_DUPLICATE_DETECTION
 #ifdef TSCH_CONF_802154_DUPLICATE_DETECTION
 #define TSCH_802154_DUPLICATE_DETECTION TSCH_CONF_802154_DUPLICATE_DETECTION
@@ -90,7 +312,7 @@ struct seqno {
 static struct seqno received_seqnos[MAX_SEQNOS];
 #endif /* TSCH_802154_DUPLICATE_DETECTION */
 
-// variable to protect queue structure
+// variable to protect queue structure, non-zero while queues are being modified
 volatile uint8_t working_on_queue;
 
 #if ( QUEUEBUF_CONF_NUM && !(QUEUEBUF_CONF_NUM & (QUEUEBUF_CONF_NUM-1)) ) /* is it a power of two? */
@@ -100,8 +322,14 @@ volatile uint8_t working_on_queue;
 #endif /* !(QUEUEBUF_CONF_NUM & (QUEUEBUF_CONF_NUM-1)) */
 #define macMinBE 1
 #define macMaxFrameRetries 4
+/* TX outcome on top of RADIO_TX_*: the frame was acknowledged with a NACK */
+#define TSCH_TX_NACK 0x10
 #define macMaxBE 4
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b)? (a) : (b))
+#endif /* MIN */
+
 // TSCH PACKET STRUCTURE
 struct TSCH_packet
 {
@@ -110,6 +338,27 @@ struct TSCH_packet
 	mac_callback_t sent; // callback for this packet
 	void *ptr; // parameters for MAC callback ... (usually NULL)
 	uint8_t ret; //status -- MAC return code
+	uint8_t header_len; // length of the MAC header at the start of pkt
+	uint8_t in_train; // more fragments of the same train follow this packet
+#if TSCH_WITH_AGGREGATION
+	uint8_t aggregated; // packets packed in its frame, fixed by its first transmission
+#endif /* TSCH_WITH_AGGREGATION */
+#if TSCH_PACKET_TTL
+	asn_t expiry_asn; // the packet is dropped if not sent by this ASN
+#endif /* TSCH_PACKET_TTL */
+#if TSCH_WITH_STATS
+	asn_t enqueue_asn; // ASN when the packet was queued
+#endif /* TSCH_WITH_STATS */
+};
+
+// Final status of a packet, kept until the MAC callback is called
+struct tsch_tx_status
+{
+	mac_callback_t sent;
+	void *ptr;
+	rimeaddr_t receiver;
+	uint8_t ret;
+	uint8_t transmissions;
 };
 
 struct neighbor_queue
@@ -119,21 +368,46 @@ struct neighbor_queue
 	uint8_t BW_value; // current value of backoff counter
 	struct TSCH_packet buffer[NBR_BUFFER_SIZE]; // circular buffer of packets. Its size should be a power of two
 	uint8_t put_ptr, get_ptr; // pointers for circular buffer implementation
+	asn_t congestion_until_asn; // the neighbor NACKed us: leave it alone until then
+	struct tsch_link_stats link;
+#if TSCH_WITH_STATS
+	struct tsch_neighbor_stats stats;
+#endif /* TSCH_WITH_STATS */
 };
 
 /* NBR_TABLE_CONF_MAX_NEIGHBORS specifies the size of the table */
 #include "net/nbr-table.h"
 NBR_TABLE(struct neighbor_queue, neighbor_list);
 
+/* Broadcast packets have their own queue, outside of the neighbor table */
+static struct neighbor_queue broadcast_queue;
+/* So do the EBs, sent on advertising cells only */
+static struct neighbor_queue eb_queue;
+PROCESS(tsch_eb_process, "tsch_eb_process");
+PROCESS(tsch_scan_process, "tsch_scan_process");
+/* EB MAC header: fcf, seqno, PAN ID, short broadcast destination, long source */
+#define EB_HEADER_LEN (7 + RIMEADDR_SIZE)
+/* content of the sync IE in an EB: after the header termination IE,
+ * the MLME payload IE descriptor and the sync sub-IE descriptor */
+#define EB_SYNC_IE_OFFSET (EB_HEADER_LEN + 3 * TSCH_IE_DESCRIPTOR_LEN)
+/* hopping sequence ID of the channel hopping sub-IE when we do not use the default sequence */
+#define EB_HOPPING_SEQUENCE_ID_CUSTOM 1
+/* flags of a hopping function in the vendor IE of an EB */
+#define EB_HOPPING_CUSTOM 0x01 // a hopping sequence other than the default one follows
+#define EB_HOPPING_SWITCH 0x02 // a switch ASN and the next hopping function follow
+/* longest vendor IE: descriptor, OUI, two hopping functions and the switch ASN */
+#define EB_VENDOR_IE_MAX_LEN (TSCH_IE_DESCRIPTOR_LEN + TSCH_IE_VENDOR_OUI_LEN + 5 \
+		+ 2 * (4 + TSCH_HOPPING_SEQUENCE_MAX_LEN))
+
 static struct TSCH_packet *
-get_next_packet_for_shared_tx(void);
+get_next_packet_for_shared_slot_tx(struct neighbor_queue **n);
 struct neighbor_queue *
 neighbor_queue_from_addr(const rimeaddr_t *addr);
 struct neighbor_queue *
 add_queue(const rimeaddr_t *addr);
 int
 remove_queue(const rimeaddr_t *addr);
-int
+struct TSCH_packet *
 add_packet_to_queue(mac_callback_t sent, void* ptr, const rimeaddr_t *addr);
 int
 remove_packet_from_queue(const rimeaddr_t *addr);
@@ -141,6 +415,14 @@ struct TSCH_packet*
 read_packet_from_queue(const rimeaddr_t *addr);
 static void
 tsch_timer(void *ptr);
+PROCESS_NAME(tsch_tx_callback_process);
+
+// neighbor whose fragment train is being sent in shared slots
+static struct neighbor_queue *train_neighbor;
+
+// ring of tx status reports: written from powercycle, read by tsch_tx_callback_process
+static struct tsch_tx_status tx_status_queue[TX_STATUS_QUEUE_SIZE];
+static volatile uint8_t tx_status_put_ptr, tx_status_get_ptr;
 
 /** This function takes the MSB of gcc generated random number
  * because the LSB alone has very bad random characteristics,
@@ -151,10 +433,142 @@ static uint8_t generate_random_byte(uint8_t window) {
 	return (random_rand() >> 8) & window;
 }
 
+// Trickle state of the EBs, run from powercycle() on advertising cells
+static asn_t eb_interval; // I
+static asn_t eb_interval_start;
+static asn_t eb_send_offset; // t, from the interval start
+static uint8_t eb_decided; // t has passed in this interval
+static volatile uint8_t eb_heard; // c, consistent EBs heard in this interval
+static volatile uint8_t eb_trickle_reset_pending = 1;
+// the EB queued was built before the last change of the hopping function
+static volatile uint8_t eb_stale;
+
+// This function starts a new trickle interval of length interval
+static void
+eb_trickle_new_interval(asn_t interval)
+{
+	eb_interval = interval;
+	eb_interval_start = ieee154e_vars.asn;
+	/* t is picked in [I/2, I) */
+	eb_send_offset = (interval >> 1) + (random_rand() & ((interval >> 1) - 1));
+	eb_decided = 0;
+	eb_heard = 0;
+}
+
+// This function tells whether the EB queued may go out on this advertising cell
+static int
+eb_trickle_may_send(void)
+{
+	int send = 0;
+	if (eb_trickle_reset_pending) {
+		eb_trickle_reset_pending = 0;
+		eb_trickle_new_interval(TSCH_EB_TRICKLE_IMIN);
+	}
+	/* advertising cells are sparse: t may only be noticed after the interval ended */
+	if (!eb_decided && ieee154e_vars.asn - eb_interval_start >= eb_send_offset) {
+		eb_decided = 1;
+		/* unless enough neighbors advertise the same thing around us */
+		send = eb_heard < TSCH_EB_TRICKLE_K;
+	}
+	if (ieee154e_vars.asn - eb_interval_start >= eb_interval) {
+		/* EBs of a time source may be 1.5 intervals apart: they must come
+		 * before its children hit TSCH_DESYNC_THRESHOLD */
+		eb_trickle_new_interval(eb_interval < ((asn_t)TSCH_EB_TRICKLE_IMIN << TSCH_EB_TRICKLE_DOUBLINGS)
+				&& 3 * eb_interval < TSCH_DESYNC_THRESHOLD
+				? eb_interval << 1 : eb_interval);
+	}
+	return send;
+}
+
+// Back to the shortest EB period, on the next advertising cell
+void
+tsch_eb_trickle_reset(void)
+{
+	eb_trickle_reset_pending = 1;
+}
+
+#if TSCH_WITH_STATS
+// This function accounts a completed packet in the histograms of its neighbor
+static void
+update_packet_stats(struct neighbor_queue *n, const struct TSCH_packet *p, uint8_t ret)
+{
+	asn_t delay = ieee154e_vars.asn - p->enqueue_asn;
+	uint8_t bin = 0;
+	while (delay && bin < TSCH_STATS_DELAY_BINS - 1) {
+		delay >>= 1;
+		bin++;
+	}
+	n->stats.delay[bin]++;
+	if (p->transmissions > 0) {
+		n->stats.transmissions[MIN(p->transmissions, TSCH_STATS_TX_BINS) - 1]++;
+	}
+	n->stats.status[MIN(ret, TSCH_STATS_STATUS_BINS - 1)]++;
+}
+#endif /* TSCH_WITH_STATS */
+
+// This function queues the final status of packet p of queue n for the upper layer
+// it must be called before the packet is freed
+static void
+post_tx_status(struct neighbor_queue *n, struct TSCH_packet *p, uint8_t ret)
+{
+	struct tsch_tx_status *s;
+	int sr;
+#if TSCH_WITH_STATS
+	update_packet_stats(n, p, ret);
+#endif /* TSCH_WITH_STATS */
+	p->ret = ret;
+	if (p->sent == NULL) {
+		return;
+	}
+	/* posted both from powercycle (rtimer interrupt) and from processes */
+	sr = splhigh();
+	if (((tx_status_put_ptr - tx_status_get_ptr) & (TX_STATUS_QUEUE_SIZE - 1)) == (TX_STATUS_QUEUE_SIZE - 1)) {
+		splx(sr);
+		COOJA_DEBUG_STR("tsch: tx status queue full\n");
+		return;
+	}
+	s = &tx_status_queue[tx_status_put_ptr];
+	s->sent = p->sent;
+	s->ptr = p->ptr;
+	s->ret = ret;
+	s->transmissions = p->transmissions;
+	rimeaddr_copy(&s->receiver, queuebuf_addr(p->pkt, PACKETBUF_ADDR_RECEIVER));
+	tx_status_put_ptr = (tx_status_put_ptr + 1) & (TX_STATUS_QUEUE_SIZE - 1);
+	splx(sr);
+	process_poll(&tsch_tx_callback_process);
+}
+
+// This function fails all packets queued for neighbor n back to the upper layer
+static void
+flush_neighbor_queue(struct neighbor_queue *n, uint8_t ret)
+{
+	while (((n->put_ptr - n->get_ptr) & (NBR_BUFFER_SIZE - 1)) > 0) {
+		post_tx_status(n, &n->buffer[n->get_ptr], ret);
+		queuebuf_free(n->buffer[n->get_ptr].pkt);
+		n->buffer[n->get_ptr].pkt = NULL;
+		n->get_ptr = (n->get_ptr + 1) & (NBR_BUFFER_SIZE - 1);
+	}
+}
+
+// Called by nbr_table when a neighbor entry is evicted to make room for another one
+static void
+neighbor_queue_removed(void *item)
+{
+	working_on_queue++;
+	if (item == train_neighbor) {
+		train_neighbor = NULL;
+	}
+	flush_neighbor_queue((struct neighbor_queue *)item, MAC_TX_ERR);
+	working_on_queue--;
+}
+
 // This function returns a pointer to the queue of neighbor whose address is equal to addr
 inline struct neighbor_queue *
 neighbor_queue_from_addr(const rimeaddr_t *addr)
 {
+	if (rimeaddr_cmp(addr, &rimeaddr_null)) {
+		return &broadcast_queue;
+	}
 	struct neighbor_queue *n = nbr_table_get_from_lladdr(neighbor_list, addr);
 	return n;
 }
@@ -166,11 +580,15 @@ neighbor_queue_from_addr(const rimeaddr_t *addr)
 struct neighbor_queue *
 add_queue(const rimeaddr_t *addr)
 {
-	working_on_queue = 1;
+	working_on_queue++;
 	struct neighbor_queue *n;
 	/* If we have an entry for this neighbor already, we renew it. */
 	n = neighbor_queue_from_addr(addr);
-	if (n == NULL) {
+	if (n == &broadcast_queue) {
+		/* the broadcast queue is static, never renewed */
+		working_on_queue--;
+		return n;
+	} else if (n == NULL) {
 		n = nbr_table_add_lladdr(neighbor_list, addr);
 	}
 	//if n was actually allocated
@@ -181,15 +599,20 @@ add_queue(const rimeaddr_t *addr)
 		n->put_ptr = 0;
 		n->get_ptr = 0;
 		n->time_source = 0;
+		n->congestion_until_asn = 0;
 		uint8_t i;
 		for (i = 0; i < NBR_BUFFER_SIZE; i++) {
 			n->buffer[i].pkt = 0;
 			n->buffer[i].transmissions = 0;
 		}
-		working_on_queue = 0;
+		memset(&n->link, 0, sizeof(n->link));
+#if TSCH_WITH_STATS
+		memset(&n->stats, 0, sizeof(n->stats));
+#endif /* TSCH_WITH_STATS */
+		working_on_queue--;
 		return n;
 	}
-	working_on_queue = 0;
+	working_on_queue--;
 	return n;
 }
 
@@ -200,44 +623,88 @@ add_queue(const rimeaddr_t *addr)
 int
 remove_queue(const rimeaddr_t *addr)
 {
-	working_on_queue = 1;
-	int i;
+	working_on_queue++;
 	struct neighbor_queue *n = neighbor_queue_from_addr(addr); // retrieve the queue from address
 	if (n != NULL) {
-		for (i = 0; i < NBR_BUFFER_SIZE; i++) {      // free packets of neighbor
-			queuebuf_free(n->buffer[i].pkt);
+		flush_neighbor_queue(n, MAC_TX_ERR);      // fail back packets of neighbor
+		if (n != &broadcast_queue) {
+			nbr_table_remove(neighbor_list, n);
 		}
-		nbr_table_remove(neighbor_list, n);
-		working_on_queue = 0;
+		working_on_queue--;
 		return 1;
 	}
-	working_on_queue = 0;
+	working_on_queue--;
 	return 0;
 }
 
 // This function adds one packet to the queue of neighbor whose address is addr
-// return 1 ok, 0 failed to allocate
+// return the queued packet, NULL failed to allocate
 // the packet to be inserted is in packetbuf
-int
+struct TSCH_packet *
 add_packet_to_queue(mac_callback_t sent, void* ptr, const rimeaddr_t *addr)
 {
 	struct neighbor_queue *n = neighbor_queue_from_addr(addr); // retrieve the queue from address
 	if (n != NULL) {
+		struct TSCH_packet *p;
 		//is queue full?
 		if (((n->put_ptr - n->get_ptr) & (NBR_BUFFER_SIZE - 1)) == (NBR_BUFFER_SIZE - 1)) {
-			return 0;
+			return NULL;
+		}
+		p = &n->buffer[n->put_ptr];
+		p->pkt = queuebuf_new_from_packetbuf(); // create new packet from packetbuf
+		if (p->pkt == NULL) {
+			return NULL;
 		}
-		n->buffer[n->put_ptr].pkt = queuebuf_new_from_packetbuf(); // create new packet from packetbuf
-		n->buffer[n->put_ptr].sent = sent;
-		n->buffer[n->put_ptr].ptr = ptr;
-		n->buffer[n->put_ptr].ret = MAC_TX_DEFERRED;
-		n->buffer[n->put_ptr].transmissions = 0;
+		p->sent = sent;
+		p->ptr = ptr;
+		p->ret = MAC_TX_DEFERRED;
+		p->transmissions = 0;
+		p->header_len = 0;
+		p->in_train = 0;
+#if TSCH_WITH_AGGREGATION
+		p->aggregated = 1;
+#endif /* TSCH_WITH_AGGREGATION */
 		n->put_ptr = (n->put_ptr + 1) & (NBR_BUFFER_SIZE - 1);
+		return p;
+	}
+	return NULL;
+}
+
+// This function removes the count packets at the tail of queue n, without reporting them
+static void
+remove_packets_from_tail(struct neighbor_queue *n, uint8_t count)
+{
+	while (count--) {
+		n->put_ptr = (n->put_ptr - 1) & (NBR_BUFFER_SIZE - 1);
+		queuebuf_free(n->buffer[n->put_ptr].pkt);
+		n->buffer[n->put_ptr].pkt = NULL;
+	}
+}
+
+// This function removes the head-packet of queue n
+// return 1 ok, 0 failed
+static int
+remove_packet_from_neighbor_queue(struct neighbor_queue *n)
+{
+	if (((n->put_ptr - n->get_ptr) & (NBR_BUFFER_SIZE - 1)) > 0) {
+		queuebuf_free(n->buffer[n->get_ptr].pkt);
+		n->buffer[n->get_ptr].pkt = NULL;
+		n->get_ptr = (n->get_ptr + 1) & (NBR_BUFFER_SIZE - 1);
 		return 1;
 	}
 	return 0;
 }
 
+// This function returns the queue packet p belongs to
+static struct neighbor_queue *
+queue_of_packet(const struct TSCH_packet *p)
+{
+	if (p >= eb_queue.buffer && p < eb_queue.buffer + NBR_BUFFER_SIZE) {
+		return &eb_queue;
+	}
+	return neighbor_queue_from_addr(queuebuf_addr(p->pkt, PACKETBUF_ADDR_RECEIVER));
+}
+
 // This function removes the head-packet of the queue of neighbor whose address is addr
 // return 1 ok, 0 failed
 // remove one packet from the queue
@@ -246,13 +713,7 @@ remove_packet_from_queue(const rimeaddr_t *addr)
 {
 	struct neighbor_queue *n = neighbor_queue_from_addr(addr); // retrieve the queue from address
 	if (n != NULL) {
-		if (((n->put_ptr - n->get_ptr) & (NBR_BUFFER_SIZE - 1)) > 0) {
-			queuebuf_free(n->buffer[n->get_ptr].pkt);
-			n->get_ptr = (n->get_ptr + 1) & (NBR_BUFFER_SIZE - 1);
-			return 1;
-		} else {
-			return 0;
-		}
+		return remove_packet_from_neighbor_queue(n);
 	}
 	return 0;
 }
@@ -286,29 +747,253 @@ read_packet_from_neighbor_queue(const struct neighbor_queue *n)
 	return 0;
 }
 
+// This function feeds the number of transmissions a unicast packet took into the ETX of its neighbor
+static void
+update_link_etx(struct neighbor_queue *n, uint8_t transmissions)
+{
+	uint16_t sample = (uint16_t)transmissions * TSCH_ETX_DIVISOR;
+	if (n->link.etx == 0) {
+		n->link.etx = sample;
+	} else {
+		/* alpha = 7/8 */
+		n->link.etx = (uint16_t)(((uint32_t)n->link.etx * 7 + sample) >> 3);
+	}
+}
+
+// This function feeds the RSSI and LQI of a received ACK into the link statistics
+static void
+update_link_signal(struct neighbor_queue *n, int8_t rssi, uint8_t lqi)
+{
+	if (n->link.lqi == 0) {
+		n->link.rssi = rssi;
+		n->link.lqi = lqi;
+	} else {
+		n->link.rssi = ((int16_t)n->link.rssi * 3 + rssi) / 4;
+		n->link.lqi = ((uint16_t)n->link.lqi * 3 + lqi) >> 2;
+	}
+}
+
+// This function reports the final status of the head packet p and removes it from its queue
+static void
+tsch_packet_done(struct TSCH_packet *p, uint8_t ret)
+{
+	uint8_t in_train = p->in_train;
+	struct neighbor_queue *n = queue_of_packet(p);
+	if (n == NULL) {
+		return;
+	}
+	post_tx_status(n, p, ret);
+	remove_packet_from_neighbor_queue(n);
+	if (ret != MAC_TX_OK && in_train) {
+		// the receiver cannot reassemble the rest of the train: drop it
+		while (in_train && (p = read_packet_from_neighbor_queue(n)) != NULL) {
+			in_train = p->in_train;
+			post_tx_status(n, p, MAC_TX_ERR);
+			remove_packet_from_neighbor_queue(n);
+		}
+	}
+	if (n == &eb_queue) {
+		// prepare the EB for the next advertising cell
+		process_poll(&tsch_eb_process);
+	}
+}
+
+#if TSCH_PACKET_TTL
+// This function fails back the packets at the head of queue n whose lifetime is over
+static void
+drop_expired_packets(struct neighbor_queue *n)
+{
+	struct TSCH_packet *p;
+	while ((p = read_packet_from_neighbor_queue(n)) != NULL
+			&& (int32_t)(ieee154e_vars.asn - p->expiry_asn) >= 0) {
+		COOJA_DEBUG_STR("tsch: packet expired\n");
+		tsch_packet_done(p, MAC_TX_ERR);
+		n->BE_value = macMinBE;
+		n->BW_value = 0;
+	}
+}
+#endif /* TSCH_PACKET_TTL */
+
+// This function tells whether neighbor n is backing off after a NACK
+static int
+neighbor_is_congested(const struct neighbor_queue *n)
+{
+	return (int32_t)(n->congestion_until_asn - ieee154e_vars.asn) > 0;
+}
+
 //this function is used to get a packet to send in a shared slot
+//the queue of the packet is returned in n
 static struct TSCH_packet *
-get_next_packet_for_shared_slot_tx(void) {
+get_next_packet_for_shared_slot_tx(struct neighbor_queue **n) {
 	static struct neighbor_queue* last_neighbor_tx = NULL;
+	struct TSCH_packet * p = NULL;
+	//finish a fragment train before serving another neighbor
+	if(train_neighbor != NULL && !neighbor_is_congested(train_neighbor)) {
+		p = read_packet_from_neighbor_queue(train_neighbor);
+		if(p != NULL) {
+			*n = train_neighbor;
+			if(!p->in_train) {
+				train_neighbor = NULL;
+			}
+			return p;
+		}
+		train_neighbor = NULL;
+	}
 	if(last_neighbor_tx == NULL) {
 		last_neighbor_tx = nbr_table_head(neighbor_list);
 	}
-	struct TSCH_packet * p = NULL;
 	while(p==NULL && last_neighbor_tx != NULL) {
-		p = read_packet_from_neighbor_queue( last_neighbor_tx );
+#if TSCH_PACKET_TTL
+		drop_expired_packets(last_neighbor_tx);
+#endif /* TSCH_PACKET_TTL */
+		if(!neighbor_is_congested(last_neighbor_tx)) {
+			p = read_packet_from_neighbor_queue( last_neighbor_tx );
+		}
+		if(p != NULL) {
+			*n = last_neighbor_tx;
+			if(p->in_train) {
+				train_neighbor = last_neighbor_tx;
+			}
+		}
 		last_neighbor_tx = nbr_table_next(neighbor_list, last_neighbor_tx);
 	}
 	return p;
 }
 /*---------------------------------------------------------------------------*/
+/* Returns a key identifying the kind of a broadcast packet, 0 if unknown.
+ * Only 6LoWPAN IPHC packets carrying ICMPv6 are recognized (e.g. RPL DIO/DIS),
+ * the key is the ICMPv6 type and code */
+static uint16_t
+broadcast_packet_type(const uint8_t *data, uint8_t len)
+{
+	static const uint8_t tf_len[4] = { 4, 3, 1, 0 };
+	static const uint8_t addr_len[4] = { 16, 8, 2, 0 };
+	static const uint8_t mcast_addr_len[4] = { 16, 6, 4, 1 };
+	uint8_t iphc0, iphc1, sam, dam, next_header, pos = 2;
+
+	if (len < 3 || (data[0] & 0xe0) != 0x60) {
+		return 0;
+	}
+	iphc0 = data[0];
+	iphc1 = data[1];
+	if (iphc0 & 0x04) {
+		/* compressed next header: UDP or extension header */
+		return 0;
+	}
+	if (iphc1 & 0x80) {
+		pos++; /* context identifier extension */
+	}
+	pos += tf_len[(iphc0 >> 3) & 3];
+	next_header = data[pos++];
+	if ((iphc0 & 3) == 0) {
+		pos++; /* inline hop limit */
+	}
+	sam = (iphc1 >> 4) & 3;
+	pos += ((iphc1 & 0x40) && sam == 0) ? 0 : addr_len[sam];
+	dam = iphc1 & 3;
+	if (iphc1 & 0x08) {
+		pos += (iphc1 & 0x04) ? 6 : mcast_addr_len[dam];
+	} else {
+		pos += ((iphc1 & 0x04) && dam == 0) ? 0 : addr_len[dam];
+	}
+	if (next_header != 58 /* ICMPv6 */ || pos + 2 > len) {
+		return 0;
+	}
+	return (data[pos] << 8) | data[pos + 1];
+}
+
+/* Replaces a queued broadcast packet of the given type with the one in packetbuf.
+ * The head packet is left alone as it may be on air.
+ * Returns the updated entry, NULL if nothing was replaced */
+static struct TSCH_packet *
+replace_broadcast_packet(uint16_t type, mac_callback_t sent, void *ptr)
+{
+	struct neighbor_queue *n = &broadcast_queue;
+	struct TSCH_packet *q = NULL;
+	struct queuebuf *pkt;
+	uint8_t i;
+
+	working_on_queue++;
+	for (i = (n->get_ptr + 1) & (NBR_BUFFER_SIZE - 1);
+			n->get_ptr != n->put_ptr && i != n->put_ptr;
+			i = (i + 1) & (NBR_BUFFER_SIZE - 1)) {
+		if (broadcast_packet_type((uint8_t *)queuebuf_dataptr(n->buffer[i].pkt) + n->buffer[i].header_len,
+				queuebuf_datalen(n->buffer[i].pkt) - n->buffer[i].header_len) == type) {
+			q = &n->buffer[i];
+			break;
+		}
+	}
+	if (q != NULL) {
+		pkt = queuebuf_new_from_packetbuf();
+		if (pkt == NULL) {
+			q = NULL;
+		} else {
+			COOJA_DEBUG_STR("tsch: replace queued broadcast\n");
+			post_tx_status(n, q, MAC_TX_ERR);
+			queuebuf_free(q->pkt);
+			q->pkt = pkt;
+			q->sent = sent;
+			q->ptr = ptr;
+			q->ret = MAC_TX_DEFERRED;
+			q->transmissions = 0;
+		}
+	}
+	working_on_queue--;
+	return q;
+}
+#if TSCH_WITH_AGGREGATION
+/* Packs the head packet of n and the packets queued behind it in one frame.
+ * The MAC header of the head packet is kept, followed by the aggregation dispatch
+ * and a length-prefixed copy of each packet payload, for at most max packets.
+ * Returns the number of packets packed; 1 means the head packet is sent as is */
+static uint8_t
+aggregate_packets(struct neighbor_queue *n, uint8_t *buf, unsigned short *len, uint8_t max)
+{
+	struct TSCH_packet *head = &n->buffer[n->get_ptr];
+	struct TSCH_packet *q;
+	uint8_t i, count = 0;
+	unsigned short total_len = head->header_len + 1;
+	uint8_t sublen;
+
+	for (i = n->get_ptr; i != n->put_ptr && count < max;
+			i = (i + 1) & (NBR_BUFFER_SIZE - 1)) {
+		q = &n->buffer[i];
+		sublen = queuebuf_datalen(q->pkt) - q->header_len;
+		if (total_len + 1 + sublen > TSCH_MAX_PACKET_LEN - TSCH_FCS_LEN) {
+			break;
+		}
+		total_len += 1 + sublen;
+		count++;
+	}
+	if (count < 2) {
+		return 1;
+	}
+	memcpy(buf, queuebuf_dataptr(head->pkt), head->header_len);
+	*len = head->header_len;
+	buf[(*len)++] = TSCH_AGGREGATION_DISPATCH;
+	for (i = 0; i < count; i++) {
+		q = &n->buffer[(n->get_ptr + i) & (NBR_BUFFER_SIZE - 1)];
+		sublen = queuebuf_datalen(q->pkt) - q->header_len;
+		buf[(*len)++] = sublen;
+		memcpy(&buf[*len], (uint8_t *)queuebuf_dataptr(q->pkt) + q->header_len, sublen);
+		*len += sublen;
+	}
+	return count;
+}
+#endif /* TSCH_WITH_AGGREGATION */
+/*---------------------------------------------------------------------------*/
 // Function send for TSCH-MAC, puts the packet in packetbuf in the MAC queue
-static int
-send_one_packet(mac_callback_t sent, void *ptr)
+// may_replace: a broadcast may take the place of a pending one of the same type
+// returns the queued packet, NULL on failure
+static struct TSCH_packet *
+send_one_packet(mac_callback_t sent, void *ptr, uint8_t may_replace)
 {
 	//send_one_packet(sent, ptr);
 	COOJA_DEBUG_STR("TSCH send_one_packet\n");
 
 	uint16_t seqno;
+	int header_len;
+	struct TSCH_packet *p;
 	const rimeaddr_t *addr = packetbuf_addr(PACKETBUF_ADDR_RECEIVER);
 	//Ask for ACK if we are sending anything other than broadcast
 	if (!rimeaddr_cmp(addr, &rimeaddr_null)) {
@@ -319,8 +1004,9 @@ send_one_packet(mac_callback_t sent, void *ptr)
 	seqno = (++ieee154e_vars.dsn) ? ieee154e_vars.dsn : ++ieee154e_vars.dsn;
 
 	packetbuf_set_attr(PACKETBUF_ATTR_MAC_SEQNO, seqno);
-	if (NETSTACK_FRAMER.create() < 0) {
-		return 0;
+	header_len = NETSTACK_FRAMER.create();
+	if (header_len < 0) {
+		return NULL;
 	}
 	struct neighbor_queue *n;
 	/* Look for the neighbor entry */
@@ -328,45 +1014,144 @@ send_one_packet(mac_callback_t sent, void *ptr)
 	if (n == NULL) {
 		//add new neighbor to list of neighbors
 		if (!add_queue(addr))
-			return 0;
-		//add new packet to neighbor list
-		if (!add_packet_to_queue(sent, ptr, addr))
-			return 0;
-	} else {
+			return NULL;
+	}
+	p = NULL;
+	if (n == &broadcast_queue && may_replace) {
+		//a newer broadcast replaces a pending one of the same type
+		uint16_t type = broadcast_packet_type(packetbuf_dataptr(), packetbuf_datalen());
+		if (type != 0) {
+			p = replace_broadcast_packet(type, sent, ptr);
+		}
+	}
+	if (p == NULL) {
 		//add new packet to neighbor list
-		if (!add_packet_to_queue(sent, ptr, addr))
-			return 0;
+		p = add_packet_to_queue(sent, ptr, addr);
 	}
-	return 1;
+	if (p == NULL) {
+		return NULL;
+	}
+	p->header_len = header_len;
+#if TSCH_PACKET_TTL
+	p->expiry_asn = ieee154e_vars.asn + TSCH_PACKET_TTL;
+#endif /* TSCH_PACKET_TTL */
+#if TSCH_WITH_STATS
+	p->enqueue_asn = ieee154e_vars.asn;
+#endif /* TSCH_WITH_STATS */
+	return p;
 }
 /*---------------------------------------------------------------------------*/
 static void
 send_packet(mac_callback_t sent, void *ptr)
 {
-	send_one_packet(sent, ptr);
+	if (send_one_packet(sent, ptr, 1) == NULL) {
+		mac_call_sent_callback(sent, ptr, MAC_TX_ERR, 0);
+	}
 }
 /*---------------------------------------------------------------------------*/
+/* Queues a train of packets (e.g. 6LoWPAN fragments) to the same neighbor.
+ * The train is admitted as a whole or not at all, as the receiver cannot
+ * reassemble a partial one. */
 static void
 send_list(mac_callback_t sent, void *ptr, struct rdc_buf_list *buf_list)
 {
-	while (buf_list != NULL) {
-		/* We backup the next pointer, as it may be nullified by
-		 * mac_call_sent_callback() */
-		struct rdc_buf_list *next = buf_list->next;
-		int last_sent_ok;
+	struct rdc_buf_list *next;
+	struct neighbor_queue *n;
+	struct TSCH_packet *p;
+	const rimeaddr_t *addr;
+	uint8_t count = 0, queued = 0;
 
-		queuebuf_to_packetbuf(buf_list->buf);
-		last_sent_ok = send_one_packet(sent, ptr);
+	if (buf_list == NULL) {
+		return;
+	}
+	for (next = buf_list; next != NULL; next = next->next) {
+		count++;
+	}
+	addr = queuebuf_addr(buf_list->buf, PACKETBUF_ADDR_RECEIVER);
+	n = neighbor_queue_from_addr(addr);
+	if (n == NULL) {
+		n = add_queue(addr);
+	}
+	/* keep powercycle away from the queue until the whole train is in */
+	working_on_queue++;
+	if (n != NULL
+			&& (NBR_BUFFER_SIZE - 1) - ((n->put_ptr - n->get_ptr) & (NBR_BUFFER_SIZE - 1)) >= count) {
+		while (buf_list != NULL) {
+			/* We backup the next pointer, as it may be nullified by
+			 * mac_call_sent_callback() */
+			next = buf_list->next;
+			queuebuf_to_packetbuf(buf_list->buf);
+			/* appended, never replaced: the rollback below counts on it */
+			p = send_one_packet(sent, ptr, 0);
+			if (p == NULL) {
+				break;
+			}
+			p->in_train = (next != NULL);
+			queued++;
+			buf_list = next;
+		}
+		if (queued != count) {
+			/* out of queuebufs: take back the part of the train already queued */
+			remove_packets_from_tail(n, queued);
+		}
+	}
+	working_on_queue--;
 
-		/* If packet transmission was not successful, we should back off and let
-		 * upper layers retransmit, rather than potentially sending out-of-order
-		 * packet fragments. */
-		if (!last_sent_ok) {
-			return;
+	if (queued != count) {
+		COOJA_DEBUG_STR("tsch: train rejected\n");
+		while (count--) {
+			mac_call_sent_callback(sent, ptr, MAC_TX_ERR, 0);
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+#if TSCH_WITH_AGGREGATION
+/* Splits an aggregated frame in packetbuf and passes each sub-frame up.
+ * Payload layout: DISPATCH, then (len, data[len]) for each packet */
+static void
+input_aggregated_packets(void)
+{
+	static uint8_t aggregate_buf[TSCH_MAX_PACKET_LEN];
+	rimeaddr_t sender, receiver;
+	uint8_t len, sublen, pos = 0;
+
+	len = packetbuf_datalen() - 1;
+	memcpy(aggregate_buf, (uint8_t *)packetbuf_dataptr() + 1, len);
+	rimeaddr_copy(&sender, packetbuf_addr(PACKETBUF_ADDR_SENDER));
+	rimeaddr_copy(&receiver, packetbuf_addr(PACKETBUF_ADDR_RECEIVER));
+	while (pos < len) {
+		sublen = aggregate_buf[pos++];
+		if (sublen == 0 || pos + sublen > len) {
+			PRINTF("tsch: malformed aggregate\n");
+			break;
 		}
-		buf_list = next;
+		packetbuf_copyfrom(&aggregate_buf[pos], sublen);
+		packetbuf_set_addr(PACKETBUF_ADDR_SENDER, &sender);
+		packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &receiver);
+		NETSTACK_MAC.input();
+		pos += sublen;
 	}
 }
+#endif /* TSCH_WITH_AGGREGATION */
+/*---------------------------------------------------------------------------*/
+static void
+input_eb(const uint8_t *buf, uint8_t len, rtimer_clock_t timestamp, int8_t rssi);
+/*---------------------------------------------------------------------------*/
+/* EBs (beacon frames of version 2) are for the MAC only */
+#define IS_EB(buf, len) ((len) >= EB_HEADER_LEN && ((buf)[0] & 0x07) == 0 \
+		&& ((buf)[1] & 0x30) == 0x20)
+/*---------------------------------------------------------------------------*/
+// Sees received frames in the radio's RX pool: EBs are handled from there,
+// without a copy to packetbuf
+static int
+rx_frame_in_place(const uint8_t *buf, uint8_t len, rtimer_clock_t timestamp, int8_t rssi)
+{
+	if (IS_EB(buf, len)) {
+		input_eb(buf, len, timestamp, rssi);
+		return 1;
+	}
+	return 0;
+}
 /*---------------------------------------------------------------------------*/
 static void
 packet_input(void)
@@ -382,7 +1167,10 @@ packet_input(void)
 	NETSTACK_DECRYPT();
 #endif /* NETSTACK_DECRYPT */
 
-	if (NETSTACK_FRAMER.parse() < 0) {
+	if (IS_EB(original_dataptr, original_datalen)) {
+		input_eb(original_dataptr, original_datalen, packetbuf_attr(PACKETBUF_ATTR_TIMESTAMP),
+				packetbuf_attr(PACKETBUF_ATTR_RSSI));
+	} else if (NETSTACK_FRAMER.parse() < 0) {
 		PRINTF("tsch: failed to parse %u\n", packetbuf_datalen());
 #if TSCH_ADDRESS_FILTER
 	} else if (!rimeaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER),
@@ -420,7 +1208,21 @@ packet_input(void)
 		}
 #endif /* TSCH_802154_DUPLICATE_DETECTION */
 
+		if (!duplicate && ieee154e_vars.is_sync
+				&& neighbor_queue_from_addr(packetbuf_addr(PACKETBUF_ADDR_SENDER)) == NULL) {
+			/* first frame of a node unknown to us: it may just have joined, advertise
+			 * the network faster. Its entry makes the next frames known ones */
+			add_queue(packetbuf_addr(PACKETBUF_ADDR_SENDER));
+			tsch_eb_trickle_reset();
+		}
+
 		if (!duplicate) {
+#if TSCH_WITH_AGGREGATION
+			if (packetbuf_datalen() > 1
+					&& ((uint8_t *)packetbuf_dataptr())[0] == TSCH_AGGREGATION_DISPATCH) {
+				input_aggregated_packets();
+			} else
+#endif /* TSCH_WITH_AGGREGATION */
 			NETSTACK_MAC.input();
 			COOJA_DEBUG_STR("tsch packet_input, Not duplicate\n");
 		}
@@ -457,17 +1259,214 @@ channel_check_interval(void)
   	if((rtimer_clock_t)(t1-now)>duration) break;												\
     while(!(cond) && RTIMER_CLOCK_LT(now, t0));  												\
   } while(0)
+
 /*---------------------------------------------------------------------------*/
-#ifndef MIN
-#define MIN(a, b) ((a) < (b)? (a) : (b))
-#endif /* MIN */
+static const uint8_t default_hopping_sequence[] = TSCH_HOPPING_SEQUENCE;
+static const uint8_t tsch_vendor_oui[TSCH_IE_VENDOR_OUI_LEN] = TSCH_VENDOR_OUI;
+/* the configured hopping sequence */
+static uint8_t hopping_sequence[TSCH_HOPPING_SEQUENCE_MAX_LEN];
+static uint8_t hopping_sequence_len;
+static uint8_t next_hopping_sequence[TSCH_HOPPING_SEQUENCE_MAX_LEN];
+static uint8_t next_hopping_sequence_len = 0;
+/* channels the hopping function maps onto, i.e., the sequence minus the blacklist */
+static uint8_t hopping_channels[TSCH_HOPPING_SEQUENCE_MAX_LEN];
+static uint8_t hopping_channels_len;
+/* asn % hopping_channels_len, maintained incrementally */
+static uint16_t hopping_index;
+/* Pending change of the hopping function: requested locally, it gets a
+ * switch ASN on the next slotframe boundary and is then advertised in EBs */
+enum { HOPPING_SWITCH_NONE, HOPPING_SWITCH_REQUESTED, HOPPING_SWITCH_SCHEDULED };
+static volatile uint8_t hopping_switch = HOPPING_SWITCH_NONE;
+static asn_t hopping_switch_asn;
+#if TSCH_WITH_CHANNEL_BLACKLIST
+/* bit i set: channel 11+i is blacklisted */
+static uint16_t channel_blacklist = 0;
+/* blacklist to switch to at hopping_switch_asn */
+static uint16_t next_channel_blacklist = 0;
+/* per-channel ACK success EWMA, 255 = always acked */
+static uint8_t channel_quality[16];
+static uint8_t channel_samples[16];
+static uint16_t blacklist_probe_counter = 0;
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+/*---------------------------------------------------------------------------*/
+/* rebuilds the hopping table; the only place where the asn modulo is computed */
+static void
+update_hopping_channels(void)
+{
+	uint8_t i;
+	hopping_channels_len = 0;
+	for (i = 0; i < hopping_sequence_len; i++) {
+#if TSCH_WITH_CHANNEL_BLACKLIST
+		if (channel_blacklist & (1 << (hopping_sequence[i] - 11))) {
+			continue;
+		}
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+		hopping_channels[hopping_channels_len++] = hopping_sequence[i];
+	}
+	if (hopping_channels_len == 0) {
+		/* never blacklist everything */
+		memcpy(hopping_channels, hopping_sequence, hopping_sequence_len);
+		hopping_channels_len = hopping_sequence_len;
+	}
+	hopping_index = ieee154e_vars.asn % hopping_channels_len;
+}
+/*---------------------------------------------------------------------------*/
+static inline void
+advance_hopping_index(uint16_t dt)
+{
+	hopping_index += dt;
+	while (hopping_index >= hopping_channels_len) {
+		hopping_index -= hopping_channels_len;
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* starts the next hopping function as a copy of the one in use, unless a
+ * switch is already pending: the caller then changes a part of it */
+static void
+init_next_hopping(void)
+{
+	if (hopping_switch == HOPPING_SWITCH_NONE) {
+		memcpy(next_hopping_sequence, hopping_sequence, hopping_sequence_len);
+		next_hopping_sequence_len = hopping_sequence_len;
+#if TSCH_WITH_CHANNEL_BLACKLIST
+		next_channel_blacklist = channel_blacklist;
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+	}
+}
+/*---------------------------------------------------------------------------*/
+int
+tsch_set_hopping_sequence(const uint8_t *sequence, uint8_t len)
+{
+	uint8_t i;
+	int s;
+	if (len == 0 || len > TSCH_HOPPING_SEQUENCE_MAX_LEN) {
+		return 0;
+	}
+	for (i = 0; i < len; i++) {
+		if (sequence[i] < 11 || sequence[i] > 26) {
+			return 0;
+		}
+	}
+	s = splhigh();
+	init_next_hopping();
+	memcpy(next_hopping_sequence, sequence, len);
+	next_hopping_sequence_len = len;
+	if (hopping_switch == HOPPING_SWITCH_NONE) {
+		hopping_switch = HOPPING_SWITCH_REQUESTED;
+	}
+	splx(s);
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+#if TSCH_WITH_CHANNEL_BLACKLIST
+static void
+update_channel_quality(uint8_t channel, uint8_t success)
+{
+	uint8_t i = channel - 11;
+	/* CCA failures count against the channel, radio errors say nothing about it */
+	if (i >= 16 || success == RADIO_TX_ERR) {
+		return;
+	}
+	channel_quality[i] = ((uint16_t)channel_quality[i] * 7
+			+ (success == RADIO_TX_OK ? 255 : 0)) >> 3;
+	if (channel_samples[i] < 0xff) {
+		channel_samples[i]++;
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* run by the coordinator at every slotframe boundary */
+static void
+compute_channel_blacklist(void)
+{
+	uint8_t i, worst, count;
+	uint16_t blacklist = channel_blacklist;
+
+	if (++blacklist_probe_counter >= TSCH_BLACKLIST_PROBE_PERIOD) {
+		/* give the blacklisted channels a fresh chance */
+		blacklist_probe_counter = 0;
+		for (i = 0; i < 16; i++) {
+			if (blacklist & (1 << i)) {
+				channel_quality[i] = 0xff;
+				channel_samples[i] = 0;
+			}
+		}
+		next_channel_blacklist = 0;
+		return;
+	}
 
+	for (count = 0, i = 0; i < 16; i++) {
+		count += (blacklist >> i) & 1;
+	}
+	/* blacklist the worst channels first */
+	while (count < TSCH_BLACKLIST_MAX_CHANNELS) {
+		worst = 16;
+		for (i = 0; i < 16; i++) {
+			if (!(blacklist & (1 << i))
+					&& channel_samples[i] >= TSCH_BLACKLIST_MIN_SAMPLES
+					&& channel_quality[i] < TSCH_BLACKLIST_THRESHOLD
+					&& (worst == 16 || channel_quality[i] < channel_quality[worst])) {
+				worst = i;
+			}
+		}
+		if (worst == 16) {
+			break;
+		}
+		blacklist |= 1 << worst;
+		count++;
+	}
+	next_channel_blacklist = blacklist;
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_set_channel_blacklist(uint16_t blacklist)
+{
+	int s = splhigh();
+	init_next_hopping();
+	next_channel_blacklist = blacklist;
+	if (hopping_switch == HOPPING_SWITCH_NONE) {
+		hopping_switch = HOPPING_SWITCH_REQUESTED;
+	}
+	splx(s);
+}
+/*---------------------------------------------------------------------------*/
+uint16_t
+tsch_get_channel_blacklist(void)
+{
+	return channel_blacklist;
+}
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+/*---------------------------------------------------------------------------*/
+void
+tsch_associate(void);
+void
+tsch_set_coordinator(uint8_t enable)
+{
+	ieee154e_vars.is_coordinator = enable;
+	ieee154e_vars.join_priority = enable ? 0 : 0xff;
+	if (enable && !ieee154e_vars.is_sync) {
+		/* stop scanning, we define the network time now */
+		tsch_associate();
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_set_join_priority(uint8_t join_priority)
+{
+	if (!ieee154e_vars.is_coordinator) {
+		ieee154e_vars.join_priority = join_priority;
+	}
+}
 /*---------------------------------------------------------------------------*/
 static uint8_t
 hop_channel(uint8_t offset)
 {
-	uint8_t channel = 11 + (offset + ieee154e_vars.asn) % 16;
-	if ( NETSTACK_RADIO_set_channel(channel)) {
+	uint16_t i = hopping_index + offset;
+	uint8_t channel;
+	while (i >= hopping_channels_len) {
+		i -= hopping_channels_len;
+	}
+	channel = hopping_channels[i];
+	if ( TSCH_RADIO.set_channel(channel)) {
 		return channel;
 	}
 	return 0;
@@ -484,8 +1483,9 @@ static const rimeaddr_t CELL_ADDRESS3 = { { 0x00, 0x12, 0x74, 03, 00, 03, 03, 03
 static const cell_t generic_shared_cell = { 0xffff, 0, LINK_OPTION_TX | LINK_OPTION_RX
 		| LINK_OPTION_SHARED, LINK_TYPE_NORMAL, &BROADCAST_CELL_ADDRESS };
 
-static const cell_t generic_eb_cell = { 0, 0, LINK_OPTION_TX, LINK_TYPE_ADVERTISING,
-		&BROADCAST_CELL_ADDRESS };
+/* listen for EBs of the others when we have none to send */
+static const cell_t generic_eb_cell = { 0, 0, LINK_OPTION_TX | LINK_OPTION_RX
+		| LINK_OPTION_SHARED, LINK_TYPE_ADVERTISING, &BROADCAST_CELL_ADDRESS };
 
 static const cell_t cell_to_1 = { 1, 0, LINK_OPTION_TX | LINK_OPTION_RX
 		| LINK_OPTION_SHARED | LINK_OPTION_TIME_KEEPING, LINK_TYPE_NORMAL,
@@ -518,6 +1518,53 @@ static volatile rtimer_clock_t start;
 #include "net/netstack.h"
 volatile unsigned char we_are_sending = 0;
 /*---------------------------------------------------------------------------*/
+// Drops an EB that advertises an outdated hopping function: tsch_packet_done()
+// has tsch_eb_process build a new one. Called from powercycle() between slots
+static void
+drop_stale_eb(void)
+{
+	struct TSCH_packet *p;
+	if (eb_stale && (p = read_packet_from_neighbor_queue(&eb_queue)) != NULL) {
+		tsch_packet_done(p, MAC_TX_ERR);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* all nodes switch to a new hopping function on the slotframe boundary
+ * announced by the EBs */
+static void
+new_slotframe_hopping(void)
+{
+#if TSCH_WITH_CHANNEL_BLACKLIST
+	if (ieee154e_vars.is_coordinator && hopping_switch == HOPPING_SWITCH_NONE) {
+		init_next_hopping();
+		compute_channel_blacklist();
+		if (next_channel_blacklist != channel_blacklist) {
+			hopping_switch = HOPPING_SWITCH_REQUESTED;
+		}
+	}
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+	if (hopping_switch == HOPPING_SWITCH_REQUESTED) {
+		/* we are on a slotframe boundary: so is the switch */
+		hopping_switch_asn = ieee154e_vars.asn + current_slotframe->length
+				* ((TSCH_HOPPING_SWITCH_DELAY + current_slotframe->length - 1) / current_slotframe->length);
+		hopping_switch = HOPPING_SWITCH_SCHEDULED;
+		eb_stale = 1;
+		tsch_eb_trickle_reset();
+	} else if (hopping_switch == HOPPING_SWITCH_SCHEDULED
+			&& (int32_t)(ieee154e_vars.asn - hopping_switch_asn) >= 0) {
+		hopping_switch = HOPPING_SWITCH_NONE;
+#if TSCH_WITH_CHANNEL_BLACKLIST
+		channel_blacklist = next_channel_blacklist;
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+		memcpy(hopping_sequence, next_hopping_sequence, next_hopping_sequence_len);
+		hopping_sequence_len = next_hopping_sequence_len;
+		update_hopping_channels();
+		eb_stale = 1;
+		tsch_eb_trickle_reset();
+	}
+	drop_stale_eb();
+}
+/*---------------------------------------------------------------------------*/
 static cell_t *
 get_cell(uint16_t timeslot)
 {
@@ -561,13 +1608,28 @@ static volatile uint8_t waiting_for_radio_interrupt = 0;
 static volatile uint8_t need_ack;
 static volatile struct received_frame_s *last_rf;
 static volatile int16_t last_drift;
+static volatile uint16_t timeslot = 0;
+/* non-zero while the association scan wants the radio on */
+static volatile uint8_t scan_listening = 0;
+/* out of sync, but still running on the predicted ASN */
+static volatile uint8_t rejoining = 0;
+/* last time we heard a time source, and when we started rejoining */
+static asn_t last_sync_asn, rejoin_start_asn;
 /*---------------------------------------------------------------------------*/
 void
 tsch_resume_powercycle(uint8_t is_ack, uint8_t need_ack_irq, struct received_frame_s * last_rf_irq)
 {
+	if (!ieee154e_vars.is_sync) {
+		/* scanning: no powercycle to resume, the driver turned the radio off after the frame */
+		if (scan_listening) {
+			NETSTACK_RADIO.on();
+		}
+		leds_off(LEDS_RED);
+		return;
+	}
 	need_ack = need_ack_irq;
 	last_rf = last_rf_irq;
-	if (waiting_for_radio_interrupt || NETSTACK_RADIO_get_rx_end_time() != 0) {
+	if (waiting_for_radio_interrupt || TSCH_RADIO.get_rx_end_time() != 0) {
 		waiting_for_radio_interrupt = 0;
 		schedule_fixed(&t, RTIMER_NOW(), 5);
 	}
@@ -582,20 +1644,18 @@ powercycle(struct rtimer *t, void *ptr)
 	 * otherwise, schedule next wakeup
 	 */
 	PT_BEGIN(&mpt);
-	static volatile uint16_t timeslot = 0;
-	static volatile int32_t drift_correction = 0;
-	static volatile int32_t drift = 0; //estimated drift to all time source neighbors
-	static volatile uint16_t drift_counter = 0; //number of received drift corrections source neighbors
 	static uint8_t cell_decison = 0;
 	static cell_t * cell = NULL;
 	static struct TSCH_packet* p = NULL;
 	static struct neighbor_queue *n = NULL;
-	start = RTIMER_NOW();
+	static uint8_t channel = 0;
+	static int16_t tx_jitter = 0;
+	//start was set to the first slot by tsch_start()
 	//while MAC-RDC is not disabled, and while its synchronized
 	while (ieee154e_vars.is_sync && ieee154e_vars.state != TSCH_OFF) {
 		COOJA_DEBUG_STR("Cell start\n");
 		/* sync with cycle start and enable capturing start & end sfd*/
-		NETSTACK_RADIO_sfd_sync(1, 1);
+		TSCH_RADIO.sfd_sync(1, 1);
 		leds_on(LEDS_GREEN);
 		cell = get_cell(timeslot);
 		if (cell == NULL || working_on_queue) {
@@ -604,7 +1664,7 @@ powercycle(struct rtimer *t, void *ptr)
 			off(keep_radio_on);
 			cell_decison = CELL_OFF;
 		} else {
-			hop_channel(cell->channel_offset);
+			channel = hop_channel(cell->channel_offset);
 			p = NULL;
 			n = NULL;
 			last_drift=0;
@@ -612,18 +1672,30 @@ powercycle(struct rtimer *t, void *ptr)
 			need_ack = 0;
 			waiting_for_radio_interrupt = 0;
 			//is there a packet to send? if not check if this slot is RX too
-			if (cell->link_options & LINK_OPTION_TX) {
+			if ((cell->link_options & LINK_OPTION_TX) && !rejoining) {
 				//is it for ADV/EB?
 				if (cell->link_type == LINK_TYPE_ADVERTISING) {
-					//TODO fetch adv/EB packets
+					drop_stale_eb();
+					p = read_packet_from_neighbor_queue(&eb_queue);
+					if (p != NULL && eb_trickle_may_send()) {
+						n = &eb_queue;
+					} else {
+						p = NULL;
+					}
 				} else { //NORMAL link
 					//pick a packet from the neighbors queue who is associated with this cell
 					n = neighbor_queue_from_addr(cell->node_address);
 					if (n != NULL) {
+#if TSCH_PACKET_TTL
+						drop_expired_packets(n);
+#endif /* TSCH_PACKET_TTL */
 						p = read_packet_from_neighbor_queue(n);
+						if(p != NULL && neighbor_is_congested(n)) {
+							p = NULL;
+						}
 						//if there it is a shared broadcast slot and there were no broadcast packets, pick any unicast packet
 						if(p==NULL && rimeaddr_cmp(cell->node_address, &BROADCAST_CELL_ADDRESS) && (cell->link_options & LINK_OPTION_SHARED)) {
-							p = get_next_packet_for_shared_slot_tx();
+							p = get_next_packet_for_shared_slot_tx(&n);
 						}
 					}
 				}
@@ -649,6 +1721,13 @@ powercycle(struct rtimer *t, void *ptr)
 				cell_decison = CELL_RX;
 			}
 
+			if(rejoining) {
+				/* out of sync: only listen where the network time can be heard */
+				cell_decison = ((cell->link_options & LINK_OPTION_RX)
+						&& (cell->link_type == LINK_TYPE_ADVERTISING
+								|| (cell->link_options & LINK_OPTION_TIME_KEEPING))) ? CELL_RX : CELL_OFF;
+			}
+
 			if(cell_decison != CELL_TX && cell_decison != CELL_RX) {
 				COOJA_DEBUG_STR("Nothing to TX or RX --> off CELL\n");
 				off(keep_radio_on);
@@ -659,11 +1738,35 @@ powercycle(struct rtimer *t, void *ptr)
 				static unsigned short payload_len = 0;
 				payload = queuebuf_dataptr(p->pkt);
 				payload_len = queuebuf_datalen(p->pkt);
+				if (n == &eb_queue) {
+					/* the ASN and join priority of an EB are only known now */
+					tsch_ie_set_sync((uint8_t *)payload + EB_SYNC_IE_OFFSET,
+							ieee154e_vars.asn, ieee154e_vars.join_priority);
+				}
 				//TODO There are small timing variations visible in cooja, which needs tuning
 				static uint8_t is_broadcast = 0, len, seqno, ret;
 				uint16_t ack_sfd_time = 0;
 				rtimer_clock_t ack_sfd_rtime = 0;
 				is_broadcast = rimeaddr_cmp(queuebuf_addr(p->pkt, PACKETBUF_ADDR_RECEIVER), &rimeaddr_null);
+#if TSCH_WITH_AGGREGATION
+				static uint8_t aggregate_buf[TSCH_MAX_PACKET_LEN];
+				static uint8_t aggregated;
+				aggregated = 1;
+				/* p may come from another neighbor's queue in a shared slot */
+				if (!is_broadcast && p == read_packet_from_neighbor_queue(n)) {
+					/* retries share the seqno of the first transmission: the receiver
+					 * drops them as duplicates, so they must carry the same packets */
+					if (p->transmissions == 0) {
+						p->aggregated = aggregate_packets(n, aggregate_buf, &payload_len, TSCH_MAX_AGGREGATED);
+					} else if (p->aggregated > 1) {
+						aggregate_packets(n, aggregate_buf, &payload_len, p->aggregated);
+					}
+					aggregated = p->aggregated;
+					if (aggregated > 1) {
+						payload = aggregate_buf;
+					}
+				}
+#endif /* TSCH_WITH_AGGREGATION */
 				we_are_sending = 1;
 				char* payload_ptr = payload;
 				//read seqno from payload!
@@ -685,17 +1788,21 @@ powercycle(struct rtimer *t, void *ptr)
 				if (cca_status == 0) {
 					success = RADIO_TX_COLLISION;
 				} else {
-					//delay before TX
-					NETSTACK_RADIO_sfd_sync(0, 1);
+					//delay before TX; capture both SFD edges of our frame
+					TSCH_RADIO.sfd_sync(1, 1);
 					schedule_fixed(t, start, TsTxOffset - delayTx);
 					PT_YIELD(&mpt);
-					//to record the duration of packet tx
+					//end of our frame relative to its nominal start (start + TsTxOffset)
 					static rtimer_clock_t tx_time;
-					tx_time = RTIMER_NOW();
 					//send packet already in radio tx buffer
 					success = NETSTACK_RADIO.transmit(payload_len);
-					tx_time = NETSTACK_RADIO_read_sfd_timer() - tx_time;
+					/* our own TX start jitter, as seen by the receiver */
+					tx_jitter = (int16_t)(TSCH_RADIO.get_tx_start_time() - (rtimer_clock_t)(start + TsTxOffset));
+					tx_time = TSCH_RADIO.get_tx_end_time() - (rtimer_clock_t)(start + TsTxOffset);
 					//limit tx_time in case of something wrong
+					if (tx_jitter < -(int16_t)delayTx || tx_jitter > (int16_t)wdRadioTx) {
+						tx_jitter = 0;
+					}
 					tx_time = MIN(tx_time, wdDataDuration);
 					off(keep_radio_on);
 
@@ -706,7 +1813,7 @@ powercycle(struct rtimer *t, void *ptr)
 							schedule_fixed(t, start,
 									TsTxOffset + tx_time + TsTxAckDelay - TsShortGT - delayRx);
 							/* disable capturing sfd */
-							NETSTACK_RADIO_sfd_sync(0, 0);
+							TSCH_RADIO.sfd_sync(0, 0);
 							PT_YIELD(&mpt);
 							COOJA_DEBUG_STR("wait for detecting ACK\n");
 							waiting_for_radio_interrupt = 1;
@@ -736,50 +1843,45 @@ powercycle(struct rtimer *t, void *ptr)
 								if (NETSTACK_RADIO.pending_packet()) {
 									COOJA_DEBUG_STR("ACK Read:\n");
 									len = NETSTACK_RADIO.read(ackbuf, ACK_LEN + EXTRA_ACK_LEN);
-								} else if (NETSTACK_RADIO_pending_irq()) {
+								} else if (TSCH_RADIO.pending_irq()) {
 									//we have received something in radio FIFO but radio interrupt has not fired because we are inside rtimer code
-									len = NETSTACK_RADIO_read_ack(ackbuf, ACK_LEN + EXTRA_ACK_LEN);
+									len = TSCH_RADIO.read_ack(ackbuf, ACK_LEN + EXTRA_ACK_LEN);
 								}
 								if (2 == ackbuf[0] && len >= ACK_LEN && seqno == ackbuf[2]) {
 									success = RADIO_TX_OK;
-									uint16_t ack_status = 0;
 									if (ackbuf[1] & 2) { //IE-list present?
 										COOJA_DEBUG_STR("ACK IE-list present");
-
-										if (len == ACK_LEN + EXTRA_ACK_LEN) {
-											COOJA_DEBUG_STR("ACK_LEN + EXTRA_ACK_LEN");
-
-											if (ackbuf[3] == 0x02 && ackbuf[4] == 0x1e) {
-												COOJA_DEBUG_STR("ACK sync header");
-
-												ack_status = ackbuf[5];
-												ack_status |= ackbuf[6] << 8;
-												/* If the originator was a time source neighbor, the receiver adjusts its own clock by incorporating the
-												 * 	difference into an average of the drift to all its time source neighbors. The averaging method is
-												 * 	implementation dependent. If the receiver is not a clock source, the time correction is ignored.
-												 */
-												if (n->time_source) {
-													COOJA_DEBUG_STR("ACK from time_source");
-
-													/* extract time correction */
-													int16_t d=0;
-													//is it a negative correction?
-													if(ack_status & 0x0800) {
-														d = -(ack_status & 0x0fff & ~0x0800);
-													} else {
-														d = ack_status & 0x0fff;
-													}
-													drift += d;
-													drift_counter++;
-												}
-												if (ack_status & NACK_FLAG) {
-													//TODO return NACK status to upper layer
-													COOJA_DEBUG_STR("ACK NACK_FLAG\n");
-												}
+										struct tsch_ie ie;
+
+										if (tsch_ie_find(&ackbuf[ACK_LEN], len - ACK_LEN, TSCH_IE_HEADER,
+												TSCH_IE_ACK_NACK_TIME_CORRECTION, &ie)
+												&& ie.len == TSCH_IE_TIME_CORRECTION_LEN) {
+											COOJA_DEBUG_STR("ACK sync header");
+											int16_t d;
+											uint8_t nack;
+											tsch_ie_get_time_correction(&ie, &d, &nack);
+											/* If the originator was a time source neighbor, the receiver adjusts its own clock by incorporating the
+											 * 	difference into an average of the drift to all its time source neighbors. The averaging method is
+											 * 	implementation dependent. If the receiver is not a clock source, the time correction is ignored.
+											 */
+											if (n->time_source) {
+												COOJA_DEBUG_STR("ACK from time_source");
+												/* convert from microseconds to sub-ticks; the receiver also
+												 * measured our TX jitter, which is not a clock offset */
+												tsch_sync_add_sample(nbr_table_get_lladdr(neighbor_list, n),
+														tsch_us_to_ticks_frac(d, TSCH_SYNC_SUBTICK_BITS)
+														+ (tx_jitter << TSCH_SYNC_SUBTICK_BITS),
+														n->link.etx, ieee154e_vars.asn);
+												last_sync_asn = ieee154e_vars.asn;
+											}
+											if (nack) {
+												/* the receiver got the frame but had no buffer for it */
+												success = TSCH_TX_NACK;
+												COOJA_DEBUG_STR("ACK NACK_FLAG\n");
 											}
-
 										}
 									}
+									update_link_signal(n, TSCH_RADIO.get_last_rssi(), TSCH_RADIO.get_last_correlation());
 									COOJA_DEBUG_STR("ACK ok\n");
 								} else {
 									success = RADIO_TX_NOACK;
@@ -798,10 +1900,21 @@ powercycle(struct rtimer *t, void *ptr)
 					}
 				}
 
+				p->transmissions++;
+#if TSCH_WITH_CHANNEL_BLACKLIST
+				/* only unicast tells us whether the channel works */
+				if (!is_broadcast) {
+					/* a NACK is still an ACK as far as the channel is concerned */
+					update_channel_quality(channel, success == TSCH_TX_NACK ? RADIO_TX_OK : success);
+				}
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
 				if (success == RADIO_TX_NOACK) {
-					p->transmissions++;
+					ret = MAC_TX_NOACK;
 					if (p->transmissions == macMaxFrameRetries) {
-						remove_packet_from_queue(queuebuf_addr(p->pkt, PACKETBUF_ADDR_RECEIVER));
+						if (!is_broadcast) {
+							update_link_etx(n, TSCH_ETX_NOACK_PENALTY);
+						}
+						tsch_packet_done(p, ret);
 						n->BE_value = macMinBE;
 						n->BW_value = 0;
 					}
@@ -813,10 +1926,21 @@ powercycle(struct rtimer *t, void *ptr)
 							n->BE_value = macMaxBE;
 						}
 					}
-					ret = MAC_TX_NOACK;
 				} else if (success == RADIO_TX_OK) {
-					remove_packet_from_queue(queuebuf_addr(p->pkt, PACKETBUF_ADDR_RECEIVER));
-					if (!read_packet_from_queue(cell->node_address)) {
+					ret = MAC_TX_OK;
+					if (!is_broadcast) {
+						update_link_etx(n, p->transmissions);
+					}
+					tsch_packet_done(p, ret);
+#if TSCH_WITH_AGGREGATION
+					/* the packets packed behind the head one were delivered as well */
+					while (--aggregated) {
+						struct TSCH_packet *q = read_packet_from_neighbor_queue(n);
+						q->transmissions++;
+						tsch_packet_done(q, ret);
+					}
+#endif /* TSCH_WITH_AGGREGATION */
+					if (!read_packet_from_neighbor_queue(n)) {
 						// if no more packets in the queue
 						n->BW_value = 0;
 						n->BE_value = macMinBE;
@@ -824,11 +1948,20 @@ powercycle(struct rtimer *t, void *ptr)
 						// if queue is not empty
 						n->BW_value = 0;
 					}
-					ret = MAC_TX_OK;
+				} else if (success == TSCH_TX_NACK) {
+					/* congested receiver: neither a link failure (ETX untouched) nor a reason
+					 * to back off the shared cell; stop serving this neighbor for a while */
+					ret = MAC_TX_COLLISION;
+					n->congestion_until_asn = ieee154e_vars.asn + TSCH_NACK_BACKOFF;
+					if (p->transmissions == macMaxFrameRetries) {
+						tsch_packet_done(p, ret);
+						n->BE_value = macMinBE;
+						n->BW_value = 0;
+					}
 				} else if (success == RADIO_TX_COLLISION) {
-					p->transmissions++;
+					ret = MAC_TX_COLLISION;
 					if (p->transmissions == macMaxFrameRetries) {
-						remove_packet_from_queue(queuebuf_addr(p->pkt, PACKETBUF_ADDR_RECEIVER));
+						tsch_packet_done(p, ret);
 						n->BE_value = macMinBE;
 						n->BW_value = 0;
 					}
@@ -840,11 +1973,10 @@ powercycle(struct rtimer *t, void *ptr)
 							n->BE_value = macMaxBE;
 						}
 					}
-					ret = MAC_TX_COLLISION;
 				} else if (success == RADIO_TX_ERR) {
-					p->transmissions++;
+					ret = MAC_TX_ERR;
 					if (p->transmissions == macMaxFrameRetries) {
-						remove_packet_from_queue(queuebuf_addr(p->pkt, PACKETBUF_ADDR_RECEIVER));
+						tsch_packet_done(p, ret);
 						n->BE_value = macMinBE;
 						n->BW_value = 0;
 					}
@@ -856,11 +1988,11 @@ powercycle(struct rtimer *t, void *ptr)
 							n->BE_value = macMaxBE;
 						}
 					}
-					ret = MAC_TX_ERR;
 				} else {
 					// successful transmission
-					remove_packet_from_queue(queuebuf_addr(p->pkt, PACKETBUF_ADDR_RECEIVER));
-					if (!read_packet_from_queue(cell->node_address)) {
+					ret = MAC_TX_OK;
+					tsch_packet_done(p, ret);
+					if (!read_packet_from_neighbor_queue(n)) {
 						// if no more packets in the queue
 						n->BW_value = 0;
 						n->BE_value = macMinBE;
@@ -868,11 +2000,7 @@ powercycle(struct rtimer *t, void *ptr)
 						// if queue is not empty
 						n->BW_value = 0;
 					}
-					ret = MAC_TX_OK;
 				}
-				/* poll MAC TX callback */
-				p->ret=ret;
-				process_post(&tsch_tx_callback_process, PROCESS_EVENT_POLL, p);
 			} else if (cell_decison == CELL_RX) {
 //				timeslot_rx(t, start, msg, MSG_LEN);
 				if (cell->link_options & LINK_OPTION_TIME_KEEPING) {
@@ -881,13 +2009,16 @@ powercycle(struct rtimer *t, void *ptr)
 				{
 					//TODO There are small timing variations visible in cooja, which needs tuning
 					static uint8_t is_broadcast = 0, len, seqno, ret;
+					static rtimer_clock_t rx_guard;
 					uint16_t ack_sfd_time = 0;
 					rtimer_clock_t ack_sfd_rtime = 0;
 
 					is_broadcast = rimeaddr_cmp(cell->node_address, &rimeaddr_null);
+					/* we may have drifted while out of sync */
+					rx_guard = rejoining ? TSCH_REJOIN_GUARD : TsLongGT;
 
 					//wait before RX
-					schedule_fixed(t, start, TsTxOffset - TsLongGT);
+					schedule_fixed(t, start, TsTxOffset - rx_guard);
 					COOJA_DEBUG_STR("schedule RX on guard time - TsLongGT");
 					PT_YIELD(&mpt);
 					//Start radio for at least guard time
@@ -898,11 +2029,11 @@ powercycle(struct rtimer *t, void *ptr)
 							|| NETSTACK_RADIO.pending_packet()
 							|| NETSTACK_RADIO.receiving_packet());
 					//Check if receiving within guard time
-					schedule_fixed(t, start, TsTxOffset + TsLongGT);
+					schedule_fixed(t, start, TsTxOffset + rx_guard);
 					PT_YIELD(&mpt);
 					COOJA_DEBUG_STR("RX on +TsLongGT");
 
-					if (!(NETSTACK_RADIO_get_rx_end_time() || cca_status || NETSTACK_RADIO.pending_packet()
+					if (!(TSCH_RADIO.get_rx_end_time() || cca_status || NETSTACK_RADIO.pending_packet()
 							|| !NETSTACK_RADIO.channel_clear()
 							|| NETSTACK_RADIO.receiving_packet())) {
 						COOJA_DEBUG_STR("RX no packet in air\n");
@@ -910,38 +2041,58 @@ powercycle(struct rtimer *t, void *ptr)
 						//no packets on air
 						ret = 0;
 					} else {
-//						if (NETSTACK_RADIO_get_rx_end_time() == 0 && (!NETSTACK_RADIO.pending_packet())) {
-//							//wait until rx finishes
-//							schedule_fixed(t, start, TsTxOffset + wdDataDuration);
-//							waiting_for_radio_interrupt = 1;
-//							COOJA_DEBUG_STR("Wait until RX is done");
-//							PT_YIELD(&mpt);
-//						}
+						if (TSCH_RADIO.get_rx_end_time() == 0) {
+							//the frame is still on air: the radio's end-of-frame interrupt resumes us
+							schedule_fixed(t, start, TsTxOffset + wdDataDuration);
+							waiting_for_radio_interrupt = 1;
+							COOJA_DEBUG_STR("Wait until RX is done");
+							PT_YIELD(&mpt);
+							waiting_for_radio_interrupt = 0;
+							if (TSCH_RADIO.get_rx_end_time() == 0) {
+								//the interrupt never came: the radio would stay stuck in this frame
+								COOJA_DEBUG_STR("RX timeout");
+								TSCH_RADIO.rx_abort();
+							}
+						}
 
 						uint16_t expected_rx = start + TsTxOffset;
-						uint16_t rx_duration = NETSTACK_RADIO_get_rx_end_time() - (start + TsTxOffset);
+						uint16_t rx_duration = TSCH_RADIO.get_rx_end_time() - (start + TsTxOffset);
 						off(keep_radio_on);
 
 						/* wait until ack time */
 						if (need_ack) {
-							schedule_fixed(t, NETSTACK_RADIO_get_rx_end_time(), TsTxAckDelay - delayTx);
+							schedule_fixed(t, TSCH_RADIO.get_rx_end_time(), TsTxAckDelay - delayTx);
 							PT_YIELD(&mpt);
 							COOJA_DEBUG_STR("send_ack()");
-							NETSTACK_RADIO_send_ack();
+							TSCH_RADIO.send_ack();
 						}
 						/* If the originator was a time source neighbor, the receiver adjusts its own clock by incorporating the
 						 * 	difference into an average of the drift to all its time source neighbors. The averaging method is
 						 * 	implementation dependent. If the receiver is not a clock source, the time correction is ignored.
 						 */
+						if (last_rf != NULL) {
+							n = neighbor_queue_from_addr(&last_rf->source_address);
+							if (rejoining && (cell->link_type == LINK_TYPE_ADVERTISING
+									|| (n != NULL && n->time_source))) {
+								/* we hear the network again: move our slots onto the sender's */
+								COOJA_DEBUG_STR("tsch: rejoined\n");
+								start -= last_drift;
+								last_drift = 0;
+								rejoining = 0;
+								last_sync_asn = ieee154e_vars.asn;
+							} else if (n != NULL && n->time_source) {
+								last_sync_asn = ieee154e_vars.asn;
+							}
+						}
 						//drift calculated in radio_interrupt
 						if (last_drift) {
 							COOJA_DEBUG_PRINTF("drift seen %d\n", last_drift);
 							// check the source address for potential time-source match
 							n = neighbor_queue_from_addr(&last_rf->source_address);
 							if(n != NULL && n->time_source) {
-								// should be the average of drifts to all time sources
-								drift_correction -= last_drift;
-								++drift_counter;
+								/* the frame came last_drift ticks early: we are late */
+								tsch_sync_add_sample(&last_rf->source_address,
+										-(last_drift << TSCH_SYNC_SUBTICK_BITS), n->link.etx, ieee154e_vars.asn);
 								COOJA_DEBUG_STR("drift recorded");
 							}
 						}
@@ -960,22 +2111,40 @@ powercycle(struct rtimer *t, void *ptr)
 
 		/* apply sync correction on the start of the new slotframe */
 		if (!next_timeslot) {
-			if(drift_counter) {
-				/* convert from microseconds to rtimer ticks and take average */
-				drift_correction += (drift*100)/(3051*drift_counter);
+			int16_t drift_correction;
+			if (rejoining) {
+				/* nothing to measure: keep compensating the drift learnt so far */
+				drift_correction = tsch_sync_predict(ieee154e_vars.asn);
+			} else {
+				/* one correction combining the samples of all time sources */
+				drift_correction = tsch_sync_correction(ieee154e_vars.asn);
+			}
+			if (!ieee154e_vars.is_coordinator) {
+				if (!rejoining && ieee154e_vars.asn - last_sync_asn > TSCH_DESYNC_THRESHOLD) {
+					/* keep ASN, drift and schedule, and listen for the network */
+					COOJA_DEBUG_STR("tsch: lost sync, rejoining\n");
+					rejoining = 1;
+					rejoin_start_asn = ieee154e_vars.asn;
+				} else if (rejoining && ieee154e_vars.asn - rejoin_start_asn > TSCH_REJOIN_TIMEOUT) {
+					COOJA_DEBUG_STR("tsch: rejoin failed, scanning\n");
+					rejoining = 0;
+					ieee154e_vars.is_sync = 0;
+					process_poll(&tsch_scan_process);
+				}
 			}
 			if(drift_correction) {
 				COOJA_DEBUG_PRINTF("New slot frame: drift_correction %d", drift_correction);
 			}	else {
 				COOJA_DEBUG_STR("New slot frame");
 			}
-			duration += (int16_t)drift_correction;
-			drift_correction = 0;
-			drift=0;
-			drift_counter=0;
+			duration += drift_correction;
 		}
 		timeslot = next_timeslot;
 		ieee154e_vars.asn += dt;
+		advance_hopping_index(dt);
+		if (!timeslot) {
+			new_slotframe_hopping();
+		}
 		start += duration;
 
 		/* check for missed deadline and skip slot accordingly in order not to corrupt the whole schedule */
@@ -989,6 +2158,10 @@ powercycle(struct rtimer *t, void *ptr)
 			uint16_t duration2 = dt * TsSlotDuration;
 			timeslot = next_timeslot;
 			ieee154e_vars.asn += dt;
+			advance_hopping_index(dt);
+			if (!timeslot) {
+				new_slotframe_hopping();
+			}
 			schedule_fixed(t, start-duration, duration + duration2);
 			start += duration2;
 		} else {
@@ -1006,84 +2179,379 @@ PT_END(&mpt);
 static int16_t
 add_sync_IE(uint8_t* buf, int32_t time_difference_32, uint8_t nack) {
 	int16_t time_difference;
-	uint16_t ack_status = 0;
-	uint8_t len=4;
-	//do the math in 32bits to save precision
-	time_difference = time_difference_32 = (time_difference_32 * 3051)/100;
-	if(time_difference >=0) {
-		ack_status=time_difference & 0x07ff;
-	} else {
-		ack_status=((-time_difference) & 0x07ff) | 0x0800;
+	/* runs in the ACK interrupt path: no division */
+	time_difference = time_difference_32 = tsch_ticks_to_us(time_difference_32);
+	tsch_ie_put_time_correction(buf, time_difference, nack);
+	return time_difference;
+}
+/*---------------------------------------------------------------------------*/
+// Tells whether sequence differs from the hopping sequence in use
+static int
+hopping_sequence_differs(const uint8_t *sequence, uint8_t len)
+{
+	return len != hopping_sequence_len || memcmp(sequence, hopping_sequence, len);
+}
+/*---------------------------------------------------------------------------*/
+// Tells whether blacklist and sequence differ from the hopping function in use
+static int
+hopping_differs(uint16_t blacklist, const uint8_t *sequence, uint8_t len)
+{
+#if TSCH_WITH_CHANNEL_BLACKLIST
+	if (blacklist != channel_blacklist) {
+		return 1;
+	}
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+	return hopping_sequence_differs(sequence, len);
+}
+/*---------------------------------------------------------------------------*/
+// Tells whether blacklist and sequence differ from the hopping function of the pending switch
+static int
+next_hopping_differs(uint16_t blacklist, const uint8_t *sequence, uint8_t len)
+{
+#if TSCH_WITH_CHANNEL_BLACKLIST
+	if (blacklist != next_channel_blacklist) {
+		return 1;
+	}
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+	return len != next_hopping_sequence_len || memcmp(sequence, next_hopping_sequence, len);
+}
+/*---------------------------------------------------------------------------*/
+// Writes a hopping function in the vendor IE of an EB: flags, blacklist,
+// then length and channels if the sequence is not the default one
+static uint8_t *
+put_hopping_function(uint8_t *p, uint8_t flags, uint16_t blacklist, const uint8_t *sequence, uint8_t len)
+{
+	if (len != sizeof(default_hopping_sequence) || memcmp(sequence, default_hopping_sequence, len)) {
+		flags |= EB_HOPPING_CUSTOM;
 	}
-	if(nack) {
-		ack_status |= 0x8000;
+	*p++ = flags;
+	*p++ = blacklist & 0xff;
+	*p++ = blacklist >> 8;
+	if (flags & EB_HOPPING_CUSTOM) {
+		*p++ = len;
+		memcpy(p, sequence, len);
+		p += len;
 	}
-	buf[0] = 0x02;
-	buf[1] = 0x1e;
-	buf[2] = ack_status & 0xff;
-	buf[3] = (ack_status >> 8) & 0xff;
-	return time_difference;
+	return p;
+}
+/*---------------------------------------------------------------------------*/
+// Reads a hopping function written by put_hopping_function(), *len is 0 for the default sequence
+// return where it ends, NULL if it is truncated
+static const uint8_t *
+get_hopping_function(const uint8_t *p, const uint8_t *end,
+		uint8_t *flags, uint16_t *blacklist, uint8_t *sequence, uint8_t *len)
+{
+	if (p + 3 > end) {
+		return NULL;
+	}
+	*flags = p[0];
+	*blacklist = p[1] | (p[2] << 8);
+	*len = 0;
+	p += 3;
+	if (*flags & EB_HOPPING_CUSTOM) {
+		if (p >= end || p[0] == 0 || p[0] > TSCH_HOPPING_SEQUENCE_MAX_LEN || p + 1 + p[0] > end) {
+			return NULL;
+		}
+		*len = p[0];
+		memcpy(sequence, &p[1], *len);
+		p += 1 + *len;
+	}
+	return p;
 }
 /*---------------------------------------------------------------------------*/
-// TODO Create an EB packet and puts it in the EB queue
+// Creates an EB in packetbuf, with sync, timeslot, channel hopping and slotframe & link IEs
+// the ASN in the sync IE is only filled in when the EB is transmitted
+// return the EB length
 static int
-send_eb(rimeaddr_t *addr, int16_t reported_drift, slotframe_t* slotframe, cell_t * links_list, uint8_t links_list_size)
+create_eb(void)
 {
-	uint8_t* buf;
-	uint16_t seqno;
-	uint8_t nack = 0;
+	uint8_t *buf, *mlme, *sf_ie, *nlinks, *vendor, *p;
+	uint8_t i;
+	uint16_t blacklist = 0, next_blacklist = 0;
+	int s;
 
-	//send_one_packet(sent, ptr);
-	COOJA_DEBUG_STR("TSCH send_one_packet\n");
 	packetbuf_clear();
-	buf = (uint8_t*)packetbuf_dataptr();
-	//default is broadcast
-	//could be unicast if sent as a reply to a specific EB request
 	packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &rimeaddr_null);
-//	const rimeaddr_t *addr = packetbuf_addr(PACKETBUF_ADDR_RECEIVER);
-	//Ask for ACK if we are sending anything otherthan broadcast
-	if (!rimeaddr_cmp(addr, &rimeaddr_null)) {
-		packetbuf_set_attr(PACKETBUF_ATTR_MAC_ACK, 1);
+	buf = (uint8_t *)packetbuf_dataptr();
+	//fcf: beacon, PAN ID compression, short destination, frame version 2, IE list present, long source
+	buf[0] = 0x40;
+	buf[1] = 0xea;
+	buf[2] = ieee154e_vars.mac_ebsn++;
+	buf[3] = TSCH_PANID & 0xff;
+	buf[4] = (TSCH_PANID >> 8) & 0xff;
+	buf[5] = 0xff;
+	buf[6] = 0xff;
+	for (i = 0; i < RIMEADDR_SIZE; i++) {
+		buf[7 + i] = rimeaddr_node_addr.u8[RIMEADDR_SIZE - 1 - i];
 	}
-	/* PACKETBUF_ATTR_MAC_SEQNO cannot be zero, due to a pecuilarity
-	 in framer-802154.c. */
-	seqno = (++ieee154e_vars.mac_ebsn) ? ieee154e_vars.mac_ebsn : ++ieee154e_vars.mac_ebsn;
-	packetbuf_set_attr(PACKETBUF_ATTR_MAC_SEQNO, seqno);
-	if (NETSTACK_FRAMER.create() < 0) {
+	p = &buf[EB_HEADER_LEN];
+	//header termination 1: payload IEs follow
+	p = tsch_ie_put_header(p, TSCH_IE_HEADER_TERMINATION_1, 0);
+	//MLME payload IE, its length is known at the end
+	mlme = p;
+	p += TSCH_IE_DESCRIPTOR_LEN;
+	//sync sub-IE: 5B ASN and join priority, set at TX time
+	p = tsch_ie_put_sub(p, TSCH_IE_SYNC, TSCH_IE_SYNC_LEN);
+	memset(p, 0, TSCH_IE_SYNC_LEN);
+	p += TSCH_IE_SYNC_LEN;
+	//timeslot sub-IE: default timeslot template
+	p = tsch_ie_put_sub(p, TSCH_IE_TIMESLOT, 1);
+	*p++ = 0x00;
+	//channel hopping sub-IE: hopping sequence ID, 0 for the default sequence.
+	//Other sequences are only given in our vendor IE
+	p = tsch_ie_put_sub(p, TSCH_IE_CHANNEL_HOPPING, 1);
+	*p++ = hopping_sequence_differs(default_hopping_sequence, sizeof(default_hopping_sequence))
+			? EB_HOPPING_SEQUENCE_ID_CUSTOM : 0;
+	//slotframe and link sub-IE: the broadcast cells of the current slotframe
+	sf_ie = p;
+	p += TSCH_IE_DESCRIPTOR_LEN;
+	*p++ = 1; // number of slotframes
+	*p++ = current_slotframe->slotframe_handle & 0xff;
+	*p++ = current_slotframe->length & 0xff;
+	*p++ = current_slotframe->length >> 8;
+	nlinks = p++;
+	*nlinks = 0;
+	for (i = 0; i < current_slotframe->on_size; i++) {
+		const cell_t *cell = current_slotframe->cells[i];
+		if (cell == NULL || !rimeaddr_cmp(cell->node_address, &BROADCAST_CELL_ADDRESS)) {
+			continue;
+		}
+		//leave room for the vendor IE and the FCS
+		if (p + 5 - buf > TSCH_MAX_PACKET_LEN - 2 - EB_VENDOR_IE_MAX_LEN) {
+			break;
+		}
+		*p++ = i;
+		*p++ = 0;
+		*p++ = cell->channel_offset;
+		*p++ = 0;
+		*p++ = cell->link_options;
+		(*nlinks)++;
+	}
+	tsch_ie_put_sub(sf_ie, TSCH_IE_SLOTFRAME_AND_LINK, p - sf_ie - TSCH_IE_DESCRIPTOR_LEN);
+	tsch_ie_put_payload(mlme, TSCH_IE_GROUP_MLME, p - mlme - TSCH_IE_DESCRIPTOR_LEN);
+	//vendor-specific payload IE, a non-standard layout of ours: OUI, the hopping
+	//function in use, then the switch ASN and the next hopping function if a
+	//switch is scheduled
+	vendor = p;
+	p += TSCH_IE_DESCRIPTOR_LEN;
+	memcpy(p, tsch_vendor_oui, TSCH_IE_VENDOR_OUI_LEN);
+	p += TSCH_IE_VENDOR_OUI_LEN;
+	s = splhigh();
+#if TSCH_WITH_CHANNEL_BLACKLIST
+	blacklist = channel_blacklist;
+	next_blacklist = next_channel_blacklist;
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+	if (hopping_switch == HOPPING_SWITCH_SCHEDULED) {
+		p = put_hopping_function(p, EB_HOPPING_SWITCH, blacklist, hopping_sequence, hopping_sequence_len);
+		*p++ = hopping_switch_asn;
+		*p++ = hopping_switch_asn >> 8;
+		*p++ = hopping_switch_asn >> 16;
+		*p++ = hopping_switch_asn >> 24;
+		*p++ = 0;
+		p = put_hopping_function(p, 0, next_blacklist, next_hopping_sequence, next_hopping_sequence_len);
+	} else {
+		p = put_hopping_function(p, 0, blacklist, hopping_sequence, hopping_sequence_len);
+	}
+	splx(s);
+	tsch_ie_put_payload(vendor, TSCH_IE_GROUP_VENDOR, p - vendor - TSCH_IE_DESCRIPTOR_LEN);
+	packetbuf_set_datalen(p - buf);
+	return p - buf;
+}
+/*---------------------------------------------------------------------------*/
+// Creates an EB and puts it in the EB queue
+// return 1 ok, 0 failed
+static int
+queue_eb(void)
+{
+	struct TSCH_packet *p;
+	if (((eb_queue.put_ptr - eb_queue.get_ptr) & (NBR_BUFFER_SIZE - 1)) == (NBR_BUFFER_SIZE - 1)) {
 		return 0;
 	}
-	//fcf
-	buf[0] = 0x02;
-	buf[1] = 0x22; //b9:IE-list-present=1 - b12-b13:frame version=2
-	buf[2] = ieee154e_vars.mac_ebsn;
-	/* Append IE timesync */
-	//Put IEs: sync, slotframe and link, timeslot and channel hopping sequence
-	if (reported_drift != 0) {
-		add_sync_IE(buf+3, reported_drift, nack);
+	/* a change of the hopping function from now on makes this EB stale */
+	eb_stale = 0;
+	if (create_eb() <= 0) {
+		return 0;
 	}
-
-	if (slotframe != NULL) {
-		if (links_list_size && links_list != NULL) {
-
-		}
+	p = &eb_queue.buffer[eb_queue.put_ptr];
+	p->pkt = queuebuf_new_from_packetbuf();
+	if (p->pkt == NULL) {
+		return 0;
 	}
+	p->sent = NULL;
+	p->ptr = NULL;
+	p->ret = MAC_TX_DEFERRED;
+	p->transmissions = 0;
+	p->header_len = EB_HEADER_LEN;
+	p->in_train = 0;
+#if TSCH_PACKET_TTL
+	p->expiry_asn = ieee154e_vars.asn + TSCH_PACKET_TTL;
+#endif /* TSCH_PACKET_TTL */
+#if TSCH_WITH_STATS
+	p->enqueue_asn = ieee154e_vars.asn;
+#endif /* TSCH_WITH_STATS */
+	eb_queue.put_ptr = (eb_queue.put_ptr + 1) & (NBR_BUFFER_SIZE - 1);
 	return 1;
 }
 /*---------------------------------------------------------------------------*/
-void
-tsch_associate(void)
+// What we learn from an EB
+struct eb_info
+{
+	rimeaddr_t source;
+	asn_t asn;
+	uint8_t join_priority;
+	uint8_t hopping_sequence_id; // of the channel hopping sub-IE
+	uint16_t channel_blacklist;
+	uint8_t hopping_sequence_len; // 0: default sequence
+	uint8_t hopping_sequence[TSCH_HOPPING_SEQUENCE_MAX_LEN];
+	uint8_t hopping_switch; // the sender switches to the next hopping function at hopping_switch_asn
+	asn_t hopping_switch_asn;
+	uint16_t next_channel_blacklist;
+	uint8_t next_hopping_sequence_len; // 0: default sequence
+	uint8_t next_hopping_sequence[TSCH_HOPPING_SEQUENCE_MAX_LEN];
+};
+/*---------------------------------------------------------------------------*/
+// Parses the sub-IEs of an MLME payload IE
+// return 1 if a sync IE was found
+static int
+parse_eb_mlme_ie(const uint8_t *buf, uint16_t len, struct eb_info *eb)
+{
+	struct tsch_ie_iterator it;
+	struct tsch_ie ie;
+	uint8_t found_sync = 0;
+	tsch_ie_iterator_init(&it, buf, len, TSCH_IE_SUB);
+	while (tsch_ie_next(&it, &ie)) {
+		if (ie.id == TSCH_IE_SYNC && ie.len >= TSCH_IE_SYNC_LEN) {
+			tsch_ie_get_sync(&ie, &eb->asn, &eb->join_priority);
+			found_sync = 1;
+		} else if (ie.id == TSCH_IE_CHANNEL_HOPPING && ie.len >= 1) {
+			eb->hopping_sequence_id = ie.content[0];
+		}
+	}
+	return found_sync;
+}
+/*---------------------------------------------------------------------------*/
+// Parses the content of our vendor IE, after the OUI: see create_eb()
+static void
+parse_eb_vendor_ie(const uint8_t *buf, uint16_t len, struct eb_info *eb)
+{
+	const uint8_t *end = buf + len;
+	uint8_t flags, next_flags;
+	asn_t asn;
+	buf = get_hopping_function(buf, end, &flags, &eb->channel_blacklist,
+			eb->hopping_sequence, &eb->hopping_sequence_len);
+	if (buf == NULL) {
+		eb->channel_blacklist = 0;
+		eb->hopping_sequence_len = 0;
+		return;
+	}
+	if ((flags & EB_HOPPING_SWITCH) && buf + 5 <= end) {
+		asn = (asn_t)buf[0] | ((asn_t)buf[1] << 8) | ((asn_t)buf[2] << 16) | ((asn_t)buf[3] << 24);
+		if (get_hopping_function(buf + 5, end, &next_flags, &eb->next_channel_blacklist,
+				eb->next_hopping_sequence, &eb->next_hopping_sequence_len) != NULL) {
+			eb->hopping_switch = 1;
+			eb->hopping_switch_asn = asn;
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+// Parses an EB laid out as the ones create_eb() makes
+// return 1 if it carries a sync IE and a hopping sequence we know
+static int
+parse_eb(const uint8_t *buf, uint8_t len, struct eb_info *eb)
+{
+	struct tsch_ie_iterator it;
+	struct tsch_ie ie;
+	uint8_t i, found_sync = 0;
+	if (len < EB_HEADER_LEN || buf[0] != 0x40 || buf[1] != 0xea) {
+		return 0;
+	}
+	memset(eb, 0, sizeof(struct eb_info));
+	for (i = 0; i < RIMEADDR_SIZE; i++) {
+		eb->source.u8[i] = buf[7 + RIMEADDR_SIZE - 1 - i];
+	}
+	//skip the header IEs, up to the header termination
+	tsch_ie_iterator_init(&it, &buf[EB_HEADER_LEN], len - EB_HEADER_LEN, TSCH_IE_HEADER);
+	while (tsch_ie_next(&it, &ie)) {
+	}
+	//payload IEs
+	tsch_ie_iterator_init(&it, it.pos, buf + len - it.pos, TSCH_IE_PAYLOAD);
+	while (tsch_ie_next(&it, &ie)) {
+		if (ie.id == TSCH_IE_GROUP_MLME) {
+			found_sync |= parse_eb_mlme_ie(ie.content, ie.len, eb);
+		} else if (ie.id == TSCH_IE_GROUP_VENDOR && ie.len >= TSCH_IE_VENDOR_OUI_LEN
+				&& !memcmp(ie.content, tsch_vendor_oui, TSCH_IE_VENDOR_OUI_LEN)) {
+			parse_eb_vendor_ie(ie.content + TSCH_IE_VENDOR_OUI_LEN, ie.len - TSCH_IE_VENDOR_OUI_LEN, eb);
+		}
+	}
+	//a sequence other than the default one is only known through our vendor IE
+	return found_sync && (eb->hopping_sequence_id == 0 || eb->hopping_sequence_len != 0);
+}
+/*---------------------------------------------------------------------------*/
+// Resolves the sequence of an EB hopping function: *len 0 is the default sequence
+static const uint8_t *
+eb_sequence(const uint8_t *sequence, uint8_t *len)
+{
+	if (*len == 0) {
+		*len = sizeof(default_hopping_sequence);
+		return default_hopping_sequence;
+	}
+	return sequence;
+}
+/*---------------------------------------------------------------------------*/
+// Switches to the given hopping function at the start of slot asn.
+// powercycle() applies it on the first slotframe boundary from then on
+static void
+schedule_hopping(uint16_t blacklist, const uint8_t *sequence, uint8_t len, asn_t asn)
+{
+	int s = splhigh();
+#if TSCH_WITH_CHANNEL_BLACKLIST
+	next_channel_blacklist = blacklist;
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+	memcpy(next_hopping_sequence, sequence, len);
+	next_hopping_sequence_len = len;
+	hopping_switch_asn = asn;
+	hopping_switch = HOPPING_SWITCH_SCHEDULED;
+	eb_stale = 1;
+	splx(s);
+}
+/*---------------------------------------------------------------------------*/
+// Follows the hopping function advertised in an EB: switches with the sender
+// at the ASN it announces, or catches up on the next slotframe boundary if we
+// missed a switch
+static void
+follow_eb_hopping(const struct eb_info *eb)
+{
+	uint16_t blacklist = eb->channel_blacklist;
+	uint8_t len = eb->hopping_sequence_len;
+	const uint8_t *sequence = eb_sequence(eb->hopping_sequence, &len);
+	if (eb->hopping_switch) {
+		uint8_t next_len = eb->next_hopping_sequence_len;
+		const uint8_t *next_sequence = eb_sequence(eb->next_hopping_sequence, &next_len);
+		if ((int32_t)(ieee154e_vars.asn - eb->hopping_switch_asn) >= 0) {
+			/* the EB was built before the switch it announces */
+			blacklist = eb->next_channel_blacklist;
+			sequence = next_sequence;
+			len = next_len;
+		} else if (!hopping_differs(blacklist, sequence, len)) {
+			if (hopping_switch != HOPPING_SWITCH_SCHEDULED || hopping_switch_asn != eb->hopping_switch_asn
+					|| next_hopping_differs(eb->next_channel_blacklist, next_sequence, next_len)) {
+				schedule_hopping(eb->next_channel_blacklist, next_sequence, next_len, eb->hopping_switch_asn);
+			}
+			return;
+		}
+	}
+	if (hopping_differs(blacklist, sequence, len)
+			&& (hopping_switch != HOPPING_SWITCH_SCHEDULED || next_hopping_differs(blacklist, sequence, len))) {
+		schedule_hopping(blacklist, sequence, len, ieee154e_vars.asn);
+	}
+}
+/*---------------------------------------------------------------------------*/
+// Starts the slotted operation: slot_start is the start of slot ieee154e_vars.asn
+static void
+tsch_start(rtimer_clock_t slot_start)
 {
-	/* TODO Synchronize
-	 * If we are a master, start right away
-	 * otherwise, wait for EBs to associate with a master
-	 */
-	COOJA_DEBUG_STR("tsch_associate\n");
 	waiting_for_radio_interrupt = 0;
 	we_are_sending = 0;
-	//for now assume we are in sync
-	ieee154e_vars.is_sync = 1;
-	//something other than 0 for now
-	ieee154e_vars.state = TSCH_ASSOCIATED;
 	//process the schedule, to create queues and find time-sources (time-keeping)
 	if(!working_on_queue) {
 		struct neighbor_queue *n;
@@ -1101,12 +2569,259 @@ tsch_associate(void)
 				}
 				if( n!= NULL ) {
 					n->time_source = (links_list[i]->link_options & LINK_OPTION_TIME_KEEPING) ? 1 : n->time_source;
+					if(n->time_source) {
+						/* never evict the queue of a time source */
+						nbr_table_lock(neighbor_list, n);
+					}
+				}
+			}
+		}
+	}
+	start = slot_start;
+	rejoining = 0;
+	tsch_eb_trickle_reset();
+	last_sync_asn = ieee154e_vars.asn;
+	ieee154e_vars.state = TSCH_ASSOCIATED;
+	ieee154e_vars.is_sync = 1;
+	schedule_fixed(&t, start - TsSlotDuration, TsSlotDuration);
+	process_poll(&tsch_eb_process);
+}
+/*---------------------------------------------------------------------------*/
+// Joins the network of an EB whose SFD was captured at sfd_time
+static void
+associate_from_eb(const struct eb_info *eb, rtimer_clock_t sfd_time)
+{
+	/* the EB SFD went out TsTxOffset into slot eb->asn: catch up with
+	 * the next slot, leaving time to set up before it starts */
+	rtimer_clock_t slot_start = sfd_time - TsTxOffset;
+	asn_t asn = eb->asn;
+	do {
+		slot_start += TsSlotDuration;
+		asn++;
+	} while (RTIMER_CLOCK_LT(slot_start, RTIMER_NOW() + TsTxOffset));
+	COOJA_DEBUG_STR("tsch: associating from EB\n");
+	ieee154e_vars.asn = asn;
+	/* one hop further than our time source, until RPL tells better */
+	ieee154e_vars.join_priority = eb->join_priority < 0xfe ? eb->join_priority + 1 : 0xff;
+	timeslot = asn % current_slotframe->length;
+	/* start with the hopping function of the network, then follow its switches */
+	hopping_switch = HOPPING_SWITCH_NONE;
+#if TSCH_WITH_CHANNEL_BLACKLIST
+	channel_blacklist = eb->channel_blacklist;
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+	hopping_sequence_len = eb->hopping_sequence_len;
+	memcpy(hopping_sequence, eb_sequence(eb->hopping_sequence, &hopping_sequence_len), hopping_sequence_len);
+	follow_eb_hopping(eb);
+	new_slotframe_hopping();
+	update_hopping_channels();
+	tsch_start(slot_start);
+	tsch_set_time_source(&eb->source);
+	process_poll(&tsch_scan_process);
+}
+/*---------------------------------------------------------------------------*/
+// Best EB heard while scanning, and its SFD time rolled forward to a recent slot
+static struct eb_info join_candidate;
+static rtimer_clock_t join_candidate_sfd;
+static int8_t join_candidate_rssi;
+static uint8_t has_join_candidate = 0;
+static clock_time_t join_select_start;
+/*---------------------------------------------------------------------------*/
+// Moves the candidate timing to the latest slot, before the rtimer wraps
+static void
+roll_join_candidate(void)
+{
+	while (RTIMER_CLOCK_LT(join_candidate_sfd + TsSlotDuration, RTIMER_NOW())) {
+		join_candidate_sfd += TsSlotDuration;
+		join_candidate.asn++;
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+join_with_candidate(void)
+{
+	has_join_candidate = 0;
+	associate_from_eb(&join_candidate, join_candidate_sfd);
+}
+/*---------------------------------------------------------------------------*/
+// Keeps the best EB to join through: lowest join priority, then strongest signal of the EB itself
+static void
+consider_join_candidate(const struct eb_info *eb, rtimer_clock_t sfd_time, int8_t rssi)
+{
+	/* 0xff: the sender is not a node to join through */
+	if (eb->join_priority == 0xff) {
+		return;
+	}
+	/* past half the rtimer period, RTIMER_CLOCK_LT takes the SFD time for a
+	 * future one and the slot start would be rolled the wrong way */
+	if ((rtimer_clock_t)(RTIMER_NOW() - sfd_time) >= (rtimer_clock_t)~(rtimer_clock_t)0 / 2) {
+		COOJA_DEBUG_STR("tsch: EB too old\n");
+		return;
+	}
+	if (has_join_candidate) {
+		roll_join_candidate();
+		if (eb->join_priority > join_candidate.join_priority
+				|| (eb->join_priority == join_candidate.join_priority && rssi <= join_candidate_rssi)) {
+			return;
+		}
+	} else {
+		has_join_candidate = 1;
+		join_select_start = clock_time();
+	}
+	memcpy(&join_candidate, eb, sizeof(struct eb_info));
+	join_candidate_sfd = sfd_time;
+	join_candidate_rssi = rssi;
+	if (TSCH_JOIN_SELECT_TIME == 0) {
+		join_with_candidate();
+	}
+}
+/*---------------------------------------------------------------------------*/
+// Called periodically by the scan: joins once the selection time is over
+static void
+update_join_candidate(void)
+{
+	if (!has_join_candidate) {
+		return;
+	}
+	roll_join_candidate();
+	if ((clock_time_t)(clock_time() - join_select_start) >= TSCH_JOIN_SELECT_TIME) {
+		join_with_candidate();
+	}
+}
+/*---------------------------------------------------------------------------*/
+// Tells whether an EB advertises the hopping function we use
+static int
+eb_is_consistent(const struct eb_info *eb)
+{
+	uint16_t blacklist = 0;
+#if TSCH_WITH_CHANNEL_BLACKLIST
+	blacklist = channel_blacklist;
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+	if (eb->channel_blacklist != blacklist) {
+		return 0;
+	}
+	if (eb->hopping_sequence_len == 0) {
+		return !hopping_sequence_differs(default_hopping_sequence, sizeof(default_hopping_sequence));
+	}
+	return !hopping_sequence_differs(eb->hopping_sequence, eb->hopping_sequence_len);
+}
+/*---------------------------------------------------------------------------*/
+// Handles a received EB: join with it, or follow the hopping function of our time source
+static void
+input_eb(const uint8_t *buf, uint8_t len, rtimer_clock_t timestamp, int8_t rssi)
+{
+	static struct eb_info eb;
+	struct neighbor_queue *n;
+	if (!parse_eb(buf, len, &eb)) {
+		return;
+	}
+	COOJA_DEBUG_STR("tsch: EB received\n");
+	if (ieee154e_vars.is_coordinator) {
+		return;
+	}
+	if (!ieee154e_vars.is_sync) {
+		consider_join_candidate(&eb, timestamp, rssi);
+		return;
+	}
+	/* trickle: redundant EBs suppress ours, inconsistent ones speed them up */
+	if (eb_is_consistent(&eb)) {
+		if (eb_heard < 0xff) {
+			eb_heard++;
+		}
+	} else {
+		tsch_eb_trickle_reset();
+	}
+	n = neighbor_queue_from_addr(&eb.source);
+	if (n == NULL || !n->time_source) {
+		return;
+	}
+	follow_eb_hopping(&eb);
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_associate(void)
+{
+	COOJA_DEBUG_STR("tsch_associate\n");
+	ieee154e_vars.is_sync = 0;
+	if (ieee154e_vars.is_coordinator) {
+		/* the coordinator is the origin of time: start right away */
+		ieee154e_vars.asn = 0;
+		timeslot = 0;
+		update_hopping_channels();
+		tsch_start(RTIMER_NOW() + TsSlotDuration);
+	} else {
+		/* listen for EBs, powercycle() starts once we picked a node to join through */
+		has_join_candidate = 0;
+		process_poll(&tsch_scan_process);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* Duty-cycled channel scan for EBs: when polled, runs until we are associated */
+PROCESS_THREAD(tsch_scan_process, ev, data)
+{
+	static struct etimer scan_timer;
+	static uint8_t scan_index = 0, dwell = 0;
+	PROCESS_BEGIN();
+	while (1) {
+		PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL);
+		COOJA_DEBUG_STR("tsch: scanning\n");
+		while (!ieee154e_vars.is_sync && !ieee154e_vars.is_coordinator) {
+			TSCH_RADIO.set_channel(hopping_sequence[scan_index]);
+			/* align the SFD capture timer with rtimer for the EB timestamps */
+			TSCH_RADIO.sfd_sync(1, 1);
+			scan_listening = 1;
+			NETSTACK_RADIO.on();
+			etimer_set(&scan_timer, TSCH_SCAN_ON_TIME);
+			PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&scan_timer) || ieee154e_vars.is_sync);
+			scan_listening = 0;
+			update_join_candidate();
+			if (ieee154e_vars.is_sync) {
+				break;
+			}
+			if (TSCH_SCAN_ON_TIME < TSCH_SCAN_PERIOD) {
+				NETSTACK_RADIO.off();
+				etimer_set(&scan_timer, TSCH_SCAN_PERIOD - TSCH_SCAN_ON_TIME);
+				PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&scan_timer) || ieee154e_vars.is_sync);
+				update_join_candidate();
+			}
+			if (++dwell >= TSCH_SCAN_DWELL) {
+				dwell = 0;
+				if (++scan_index >= hopping_sequence_len) {
+					scan_index = 0;
 				}
 			}
 		}
+		scan_listening = 0;
+	}
+	PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_set_time_source(const rimeaddr_t *addr)
+{
+	struct neighbor_queue *n, *time_source;
+	if (addr == NULL || rimeaddr_cmp(addr, &rimeaddr_null)) {
+		return;
+	}
+	time_source = neighbor_queue_from_addr(addr);
+	if (time_source == NULL) {
+		time_source = add_queue(addr);
+		if (time_source == NULL) {
+			/* no room: keep the time sources we have */
+			return;
+		}
+	}
+	/* demote the previous time sources */
+	for (n = nbr_table_head(neighbor_list); n != NULL; n = nbr_table_next(neighbor_list, n)) {
+		if (n != time_source && n->time_source) {
+			n->time_source = 0;
+			nbr_table_unlock(neighbor_list, n);
+			tsch_sync_remove_source(nbr_table_get_lladdr(neighbor_list, n));
+		}
+	}
+	if (!time_source->time_source) {
+		time_source->time_source = 1;
+		nbr_table_lock(neighbor_list, time_source);
 	}
-	start = RTIMER_NOW();
-	schedule_fixed(&t, start, TsSlotDuration);
 }
 /*---------------------------------------------------------------------------*/
 volatile uint8_t ackbuf[1+ACK_LEN + EXTRA_ACK_LEN]={0};
@@ -1117,13 +2832,13 @@ void tsch_make_sync_ack(uint8_t **buf, uint8_t seqno, rtimer_clock_t last_packet
 	/* calculating sync in rtimer ticks */
 	time_difference_32 = (int32_t)start + TsTxOffset - last_packet_timestamp;
 	last_drift = time_difference_32;
-	/* ackbuf[1+ACK_LEN + EXTRA_ACK_LEN] = {ACK_LEN + EXTRA_ACK_LEN + AUX_LEN, 0x02, 0x00, seqno, 0x02, 0x1e, ack_status_LSB, ack_status_MSB}; */
+	/* ackbuf[1+ACK_LEN + EXTRA_ACK_LEN] = {ACK_LEN + EXTRA_ACK_LEN + FCS, 0x02, 0x00, seqno, time correction IE}; */
 	ackbuf[1] = 0x02; /* ACK frame */
 	ackbuf[2] = 0x22; /* b9:IE-list-present=1 - b12-b13:frame version=2 */
 	ackbuf[3] = seqno;
 	/* Append IE timesync */
 	add_sync_IE(&ackbuf[4], time_difference_32, nack);
-	ackbuf[0] = 3 /*FCF 2B + SEQNO 1B*/ + 4 /* sync IE size */;
+	ackbuf[0] = 3 /*FCF 2B + SEQNO 1B*/ + TSCH_IE_DESCRIPTOR_LEN + TSCH_IE_TIME_CORRECTION_LEN;
 }
 /*---------------------------------------------------------------------------*/
 static void
@@ -1138,20 +2853,41 @@ init(void)
 	ieee154e_vars.sync_timeout = 0; //30sec/slotDuration - (asn-asn0)*slotDuration
 	ieee154e_vars.mac_ebsn = 0;
 	ieee154e_vars.join_priority = 0xff; /* inherit from RPL - PAN coordinator: 0 -- lower is better */
-	nbr_table_register(neighbor_list, NULL);
+	ieee154e_vars.is_coordinator = 0;
+#if TSCH_WITH_CHANNEL_BLACKLIST
+	memset(channel_quality, 0xff, sizeof(channel_quality));
+	memset(channel_samples, 0, sizeof(channel_samples));
+	channel_blacklist = next_channel_blacklist = 0;
+#endif /* TSCH_WITH_CHANNEL_BLACKLIST */
+	hopping_switch = HOPPING_SWITCH_NONE;
+	memcpy(hopping_sequence, default_hopping_sequence, sizeof(default_hopping_sequence));
+	hopping_sequence_len = sizeof(default_hopping_sequence);
+	next_hopping_sequence_len = 0;
+	update_hopping_channels();
+	nbr_table_register(neighbor_list, neighbor_queue_removed);
+	memset(&broadcast_queue, 0, sizeof(broadcast_queue));
+	broadcast_queue.BE_value = macMinBE;
+	memset(&eb_queue, 0, sizeof(eb_queue));
+	eb_queue.BE_value = macMinBE;
+	tx_status_put_ptr = tx_status_get_ptr = 0;
+	process_start(&tsch_tx_callback_process, NULL);
+	process_start(&tsch_eb_process, NULL);
+	process_start(&tsch_scan_process, NULL);
+	tsch_rpl_init();
+	tsch_sync_init();
 	working_on_queue = 0;
 	softack_make_callback_f *softack_make = tsch_make_sync_ack;
 	softack_interrupt_exit_callback_f *interrupt_exit = tsch_resume_powercycle;
-	NETSTACK_RADIO_softack_subscribe(softack_make, interrupt_exit);
+	TSCH_RADIO.softack_subscribe(softack_make, interrupt_exit);
+	TSCH_RADIO.rx_subscribe(rx_frame_in_place);
 
-	//schedule next wakeup? or leave for higher layer to decide? i.e, scan, ...
+	//scan for EBs; tsch_set_coordinator() starts the network instead
 	tsch_associate();
 }
 /*---------------------------------------------------------------------------*/
 /* a polled-process to invoke the MAC tx callback asynchronously */
 PROCESS_THREAD(tsch_tx_callback_process, ev, data)
 {
-	int len;
 	PROCESS_BEGIN();
 	PRINTF("tsch_tx_callback_process: started\n");
 	while (1) {
@@ -1159,15 +2895,85 @@ PROCESS_THREAD(tsch_tx_callback_process, ev, data)
 
 		PRINTF("tsch_tx_callback_process: calling mac tx callback\n");
 		COOJA_DEBUG_STR("tsch_tx_callback_process: calling mac tx callback\n");
-		if(data != NULL) {
-			struct TSCH_packet* p = (struct TSCH_packet*) data;
-			/* XXX callback -- do we need to restore the packet to packetbuf? */
-			mac_call_sent_callback(p->sent, p->ptr, p->ret, p->transmissions);
+		while (tx_status_get_ptr != tx_status_put_ptr) {
+			struct tsch_tx_status *s = &tx_status_queue[tx_status_get_ptr];
+			/* upper layers look up the neighbor of the callback in packetbuf */
+			packetbuf_clear();
+			packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &s->receiver);
+			mac_call_sent_callback(s->sent, s->ptr, s->ret, s->transmissions);
+			tx_status_get_ptr = (tx_status_get_ptr + 1) & (TX_STATUS_QUEUE_SIZE - 1);
 		}
 	}
 	PROCESS_END();
 }
 /*---------------------------------------------------------------------------*/
+/* a polled-process to keep an EB ready for the next advertising cell */
+PROCESS_THREAD(tsch_eb_process, ev, data)
+{
+	PROCESS_BEGIN();
+	while (1) {
+		PROCESS_YIELD_UNTIL(ev == PROCESS_EVENT_POLL);
+		if (ieee154e_vars.is_sync && read_packet_from_neighbor_queue(&eb_queue) == NULL) {
+			if (!queue_eb()) {
+				COOJA_DEBUG_STR("tsch: failed to queue EB\n");
+			}
+		}
+	}
+	PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+const struct tsch_link_stats *
+tsch_get_link_stats(const rimeaddr_t *addr)
+{
+	struct neighbor_queue *n = neighbor_queue_from_addr(addr);
+	return n != NULL && n != &broadcast_queue ? &n->link : NULL;
+}
+/*---------------------------------------------------------------------------*/
+uint16_t
+tsch_get_link_etx(const rimeaddr_t *addr)
+{
+	const struct tsch_link_stats *s = tsch_get_link_stats(addr);
+	return s != NULL ? s->etx : 0;
+}
+/*---------------------------------------------------------------------------*/
+#if TSCH_WITH_STATS
+const struct tsch_neighbor_stats *
+tsch_get_neighbor_stats(const rimeaddr_t *addr)
+{
+	struct neighbor_queue *n = neighbor_queue_from_addr(addr);
+	return n != NULL ? &n->stats : NULL;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_neighbor_stats(const rimeaddr_t *addr, const struct tsch_neighbor_stats *s)
+{
+	uint8_t i;
+	printf("tsch stats %02x%02x delay", addr->u8[RIMEADDR_SIZE - 2], addr->u8[RIMEADDR_SIZE - 1]);
+	for (i = 0; i < TSCH_STATS_DELAY_BINS; i++) {
+		printf(" %u", s->delay[i]);
+	}
+	printf(" tx");
+	for (i = 0; i < TSCH_STATS_TX_BINS; i++) {
+		printf(" %u", s->transmissions[i]);
+	}
+	printf(" status");
+	for (i = 0; i < TSCH_STATS_STATUS_BINS; i++) {
+		printf(" %u", s->status[i]);
+	}
+	printf("\n");
+}
+/*---------------------------------------------------------------------------*/
+void
+tsch_print_stats(void)
+{
+	struct neighbor_queue *n;
+	print_neighbor_stats(&rimeaddr_null, &broadcast_queue.stats);
+	for (n = nbr_table_head(neighbor_list); n != NULL; n = nbr_table_next(neighbor_list, n)) {
+		print_neighbor_stats(nbr_table_get_lladdr(neighbor_list, n), &n->stats);
+	}
+}
+#endif /* TSCH_WITH_STATS */
+/*---------------------------------------------------------------------------*/
 const struct rdc_driver tschrdc_driver = {
 	"tschrdc",
 	init,
@@ -45,5 +45,60 @@
 
 extern const struct rdc_driver tschrdc_driver;
 
+/* Per-neighbor MAC statistics, maintained when TSCH_CONF_WITH_STATS is set */
+/* Queueing delay in slots, in log2 bins: 0, 1, 2-3, 4-7, ..., >= 64 */
+#define TSCH_STATS_DELAY_BINS 8
+/* Transmissions per packet: 1, 2, ..., >= TSCH_STATS_TX_BINS */
+#define TSCH_STATS_TX_BINS 4
+/* Final status, indexed by MAC_TX_* return code */
+#define TSCH_STATS_STATUS_BINS 6
+
+struct tsch_neighbor_stats {
+	uint16_t delay[TSCH_STATS_DELAY_BINS];
+	uint16_t transmissions[TSCH_STATS_TX_BINS];
+	uint16_t status[TSCH_STATS_STATUS_BINS];
+};
+
+/* Returns the statistics of a neighbor (rimeaddr_null for broadcast), NULL if unknown */
+const struct tsch_neighbor_stats *tsch_get_neighbor_stats(const rimeaddr_t *addr);
+/* Prints the statistics of all neighbors */
+void tsch_print_stats(void);
+
+/* Link quality of a neighbor, estimated from the outcome of unicast transmissions */
+#define TSCH_ETX_DIVISOR 128
+struct tsch_link_stats {
+	uint16_t etx;	/* EWMA of transmissions per packet, times TSCH_ETX_DIVISOR. 0 if unknown */
+	int8_t rssi;	/* EWMA of the raw RSSI of received ACKs */
+	uint8_t lqi;	/* EWMA of the correlation (LQI) of received ACKs */
+};
+
+/* Returns the link statistics of a neighbor, NULL if unknown */
+const struct tsch_link_stats *tsch_get_link_stats(const rimeaddr_t *addr);
+/* Returns the ETX of a neighbor times TSCH_ETX_DIVISOR, 0 if unknown */
+uint16_t tsch_get_link_etx(const rimeaddr_t *addr);
+
+/* Makes neighbor addr our only time source, demoting the previous ones */
+void tsch_set_time_source(const rimeaddr_t *addr);
+
+/* Makes this node the PAN coordinator, which also owns the channel blacklist */
+void tsch_set_coordinator(uint8_t enable);
+/* Sets the join priority advertised in EBs (lower is better, 0xff: do not
+ * join through us). The coordinator always advertises 0 */
+void tsch_set_join_priority(uint8_t join_priority);
+
+/* Restarts the EB trickle timer at its shortest period, e.g., on schedule
+ * changes or when nodes are joining */
+void tsch_eb_trickle_reset(void);
+
+/* Channel blacklist (TSCH_CONF_WITH_CHANNEL_BLACKLIST), bit i for channel 11+i.
+ * A new blacklist gets a switch ASN on the next slotframe boundary, about
+ * TSCH_CONF_HOPPING_SWITCH_DELAY slots ahead; EBs announce it so that the
+ * whole network switches at that slot */
+void tsch_set_channel_blacklist(uint16_t blacklist);
+uint16_t tsch_get_channel_blacklist(void);
+/* Installs a new hopping sequence (channels 11..26), with the same switch
+ * ASN mechanism as the blacklist. Returns 0 if the sequence is invalid */
+int tsch_set_hopping_sequence(const uint8_t *sequence, uint8_t len);
+
 
 #endif /* __TSCH_H__ */
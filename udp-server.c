@@ -44,6 +44,7 @@
 //#include "net/uip-debug.h"
 
 #include "cooja-debug.h"
+#include "tsch.h"
 #define PRINTF COOJA_DEBUG_PRINTF
 #define PRINT6ADDR COOJA_DEBUG_ADDR16
 
@@ -142,6 +143,7 @@ PROCESS_THREAD(udp_server_process, ev, data)
     dag = rpl_set_root(RPL_DEFAULT_INSTANCE,(uip_ip6addr_t *)&ipaddr);
     uip_ip6addr(&ipaddr, 0xaaaa, 0, 0, 0, 0, 0, 0, 0);
     rpl_set_prefix(dag, &ipaddr, 64);
+    tsch_set_coordinator(1);
     PRINTF("created a new RPL dag\n");
   } else {
     PRINTF("failed to create a new RPL DAG\n");